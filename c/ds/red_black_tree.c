@@ -6,25 +6,145 @@
  */
 #include <stdio.h>
 #include <stdlib.h>
-// 颜色定义
-typedef enum Color{
-    BLACK,
-    RED
-} Color;
-// 节点定义
-typedef struct TNode{
-    struct TNode* left;
-    struct TNode* right;
-    struct TNode* parent;
-    Color color;
-    int value; // 可以采用 void* 来保存任意类型，不过这样的话，
-               // 就需要提供一个 compare 的函数指针了，比较麻烦，
-               // 这里就用 int，目的是理解数据结构本身
-} TNode;
-
-typedef struct RbTree{
-    TNode * root;
-} RbTree;
+#include <string.h>
+#include "red_black_tree.h"
+#ifdef RB_STATS
+#include <pthread.h>
+#endif
+
+TNode* malloc_alloc(NodeAllocator *a){
+    return (TNode*) malloc(sizeof(TNode));
+}
+
+void malloc_free(NodeAllocator *a, TNode *node){
+    free(node);
+}
+
+// 默认的分配器，每个节点单独 malloc/free，所有树共享
+NodeAllocator malloc_allocator = { malloc_alloc, malloc_free, NULL, NULL, 0 };
+
+/**
+ * slab 分配器：每次向系统申请一整块（slab）能放下 slab_nodes 个节点的内存，
+ * 从中依次切出节点；被回收的节点通过 left 指针串成一个侵入式的空闲链表，下次优先复用。
+ * 释放整棵树时直接把所有 slab 还给系统，不需要遍历节点。
+ */
+typedef struct Slab{
+    struct Slab* next;
+    size_t count;         // 本 slab 的节点数
+    TNode nodes[];
+} Slab;
+
+typedef struct SlabAllocator{
+    NodeAllocator base;   // 必须是第一个成员
+    Slab* slabs;          // 已申请的 slab 链表，最新的在表头
+    TNode* free_list;     // 回收的节点，通过 left 串联
+    size_t slab_nodes;    // 每个 slab 的节点数
+    size_t used;          // 表头 slab 中已切出的节点数
+} SlabAllocator;
+
+TNode* slab_alloc(NodeAllocator *a){
+    SlabAllocator* sa = (SlabAllocator*) a;
+    TNode* node = sa->free_list;
+    if(node){
+        sa->free_list = node->left;
+        return node;
+    }
+
+    if(!sa->slabs || sa->used == sa->slabs->count){
+        Slab* slab = (Slab*) malloc(sizeof(Slab) + sa->slab_nodes * sizeof(TNode));
+        if(!slab) return NULL;
+        slab->next = sa->slabs;
+        slab->count = sa->slab_nodes;
+        sa->slabs = slab;
+        sa->used = 0;
+    }
+
+    return &sa->slabs->nodes[sa->used++];
+}
+
+void slab_free(NodeAllocator *a, TNode *node){
+    SlabAllocator* sa = (SlabAllocator*) a;
+    node->left = sa->free_list;
+    sa->free_list = node;
+}
+
+/**
+ * 一次性申请一块正好能放下 n 个节点的连续内存，并全部标记为已使用，返回首个节点
+ * 用于批量建树，节点之后可以正常通过 slab_free 回收
+ */
+TNode* slab_reserve(NodeAllocator *a, size_t n){
+    SlabAllocator* sa = (SlabAllocator*) a;
+    Slab* slab = (Slab*) malloc(sizeof(Slab) + n * sizeof(TNode));
+    if(!slab) return NULL;
+    slab->count = n;
+    if(sa->slabs && sa->used < sa->slabs->count){
+        // 当前 slab 还没用完，把新的整块挂在它后面，不影响继续切分
+        slab->next = sa->slabs->next;
+        sa->slabs->next = slab;
+    } else {
+        slab->next = sa->slabs;
+        sa->slabs = slab;
+        sa->used = n;
+    }
+    return slab->nodes;
+}
+
+void slab_release(NodeAllocator *a){
+    SlabAllocator* sa = (SlabAllocator*) a;
+    Slab* slab = sa->slabs;
+    while(slab){
+        Slab* next = slab->next;
+        free(slab);
+        slab = next;
+    }
+    sa->slabs = NULL;
+    sa->free_list = NULL;
+    sa->used = 0;
+}
+
+void slab_destroy(NodeAllocator *a){
+    slab_release(a);
+    free(a);
+}
+
+/**
+ * 只保留 nodes 所在的 slab（其中前 used 个节点在使用），其余 slab 和空闲链表全部还给系统
+ * 用于 relayout 把一棵树的所有节点搬进一整块之后回收旧的内存
+ */
+static void slab_keep(NodeAllocator *a, TNode* nodes, size_t used){
+    SlabAllocator* sa = (SlabAllocator*) a;
+    Slab* keep = NULL;
+    Slab* slab = sa->slabs;
+    while(slab){
+        Slab* next = slab->next;
+        if(slab->nodes == nodes) keep = slab;
+        else free(slab);
+        slab = next;
+    }
+    sa->slabs = keep;
+    if(keep) keep->next = NULL;
+    sa->free_list = NULL;
+    sa->used = used;
+}
+
+NodeAllocator* new_slab_allocator(size_t slab_nodes){
+    SlabAllocator* sa = (SlabAllocator*) malloc(sizeof(SlabAllocator));
+    if(!sa){
+        perror("create slab allocator error.");
+        return NULL;
+    }
+
+    sa->base.alloc = slab_alloc;
+    sa->base.free = slab_free;
+    sa->base.release = slab_release;
+    sa->base.destroy = slab_destroy;
+    sa->base.refs = 1;
+    sa->slabs = NULL;
+    sa->free_list = NULL;
+    sa->slab_nodes = slab_nodes ? slab_nodes : 4096;
+    sa->used = 0;
+    return &sa->base;
+}
 
 TNode* grand_parent(const TNode *n){
     if(n && n->parent)
@@ -52,8 +172,102 @@ TNode* sibling(const TNode* n){
     }
 }
 
-TNode* new_node(int value){
-    TNode* node = (TNode*) malloc(sizeof(TNode));
+// ------------------------- 运行统计 -------------------------
+#ifdef RB_STATS
+typedef struct RbStatsSlot{
+    RbStats s;
+} __attribute__((aligned(64))) RbStatsSlot;
+
+/**
+ * 槽位编号在线程退出时通过 pthread key 的析构函数归还，同时存活的线程不超过 RB_STATS_THREADS 个时每个线程独占一个槽位。
+ * 超出时（没有空闲编号）按顺序取模共享槽位，这样的线程用原子加；独占的线程用原子的 load/store（不加 lock 前缀，与普通加法一样快），
+ * 所有访问都是原子的，不存在数据竞争，只有共享时独占线程的计数可能丢失少量
+ */
+static __thread int stats_thread_id = -1;
+static __thread int stats_shared;
+static unsigned char stats_used[RB_STATS_THREADS];
+static int stats_next_shared;
+static pthread_key_t stats_key;
+static pthread_once_t stats_once = PTHREAD_ONCE_INIT;
+
+static void stats_release_id(void* arg){
+    __atomic_store_n(&stats_used[(size_t) arg - 1], 0, __ATOMIC_RELEASE);
+}
+
+static void stats_init_key(void){
+    pthread_key_create(&stats_key, stats_release_id);
+}
+
+static int stats_acquire_id(void){
+    int i;
+    pthread_once(&stats_once, stats_init_key);
+    for(i = 0; i < RB_STATS_THREADS; ++i){
+        unsigned char expected = 0;
+        if(!__atomic_load_n(&stats_used[i], __ATOMIC_RELAXED)
+            && __atomic_compare_exchange_n(&stats_used[i], &expected, 1, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)){
+            // 析构函数只在值非空时调用，存 i + 1
+            if(pthread_setspecific(stats_key, (void*)(size_t)(i + 1)) != 0){
+                __atomic_store_n(&stats_used[i], 0, __ATOMIC_RELEASE);
+                break;
+            }
+            return i;
+        }
+    }
+    stats_shared = 1;
+    return __atomic_fetch_add(&stats_next_shared, 1, __ATOMIC_RELAXED) % RB_STATS_THREADS;
+}
+
+// 当前线程在这棵树上的计数槽
+static RbStats* stats_slot(const RbTree* tree){
+    if(stats_thread_id < 0) stats_thread_id = stats_acquire_id();
+    return &tree->stats[stats_thread_id].s;
+}
+
+static void stat_add(unsigned long* counter, unsigned long n){
+    if(stats_shared) __atomic_fetch_add(counter, n, __ATOMIC_RELAXED);
+    else __atomic_store_n(counter, __atomic_load_n(counter, __ATOMIC_RELAXED) + n, __ATOMIC_RELAXED);
+}
+
+#define STAT_ADD(tree, field, n) stat_add(&stats_slot(tree)->field, (n))
+#define STAT_HIST(tree, field, depth) \
+    stat_add(&stats_slot(tree)->field[(depth) < RB_STATS_DEPTH ? (depth) : RB_STATS_DEPTH - 1], 1)
+#else
+#define STAT_ADD(tree, field, n) ((void) 0)
+#define STAT_HIST(tree, field, depth) ((void) 0)
+#endif
+
+// 把所有线程的计数累加到 out 中
+int get_stats(const RbTree* tree, RbStats* out){
+#ifdef RB_STATS
+    size_t i, t;
+    unsigned long* dst = (unsigned long*) out;
+    memset(out, 0, sizeof(RbStats));
+    for(t = 0; t < RB_STATS_THREADS; ++t){
+        const unsigned long* src = (const unsigned long*) &tree->stats[t].s;
+        for(i = 0; i < sizeof(RbStats) / sizeof(unsigned long); ++i) dst[i] += __atomic_load_n(&src[i], __ATOMIC_RELAXED);
+    }
+    return 0;
+#else
+    (void) tree;
+    memset(out, 0, sizeof(RbStats));
+    return -1;
+#endif
+}
+
+// 清零所有线程的计数，不能与其他线程的操作并发调用
+int reset_stats(RbTree* tree){
+#ifdef RB_STATS
+    memset(tree->stats, 0, RB_STATS_THREADS * sizeof(RbStatsSlot));
+    return 0;
+#else
+    (void) tree;
+    return -1;
+#endif
+}
+
+// 从树的分配器中申请一个节点
+TNode* alloc_node(RbTree* tree, int value){
+    TNode* node = tree->allocator->alloc(tree->allocator);
     if(!node){
         perror("create node error.");
         return NULL;
@@ -62,16 +276,103 @@ TNode* new_node(int value){
     node->value = value;
     node->color = RED;
     node->left = node->parent = node->right = NULL;
+    memset(&node->aug, 0, sizeof(node->aug));
 
     return node;
 }
 
-RbTree* new_tree(){
+void free_node(RbTree* tree, TNode* node){
+    // 回收的节点可能还在 relayout_step 待处理的队列中
+    if(tree->relayout) relayout_cancel(tree);
+    tree->allocator->free(tree->allocator, node);
+}
+
+/**
+ * 创建一棵使用指定分配器的树，分配器归树所有，destroy_tree 时一并销毁
+ * @return 内存不足时返回 NULL，分配器仍归调用方
+ */
+RbTree* new_tree_with_allocator(NodeAllocator* allocator){
     RbTree* tree = (RbTree*) malloc(sizeof(RbTree));
+    if(!tree){
+        perror("create tree error.");
+        return NULL;
+    }
     tree->root = NULL;
+    tree->allocator = allocator ? allocator : &malloc_allocator;
+    tree->augment = NULL;
+    tree->size = 0;
+    tree->leftmost = tree->rightmost = NULL;
+    tree->pending = NULL;
+    tree->pending_count = tree->pending_limit = 0;
+    tree->relayout = NULL;
+#ifdef RB_STATS
+    tree->stats = (RbStatsSlot*) aligned_alloc(64, RB_STATS_THREADS * sizeof(RbStatsSlot));
+    if(!tree->stats){
+        perror("create tree error.");
+        free(tree);
+        return NULL;
+    }
+    memset(tree->stats, 0, RB_STATS_THREADS * sizeof(RbStatsSlot));
+#endif
     return tree;
 }
 
+RbTree* new_tree(){
+    return new_tree_with_allocator(&malloc_allocator);
+}
+
+/**
+ * 创建一棵与 tree 共用分配器、附加信息维护方式相同的空树，两棵树的节点可以互相移动
+ */
+RbTree* new_tree_sharing(const RbTree* tree){
+    NodeAllocator* a = tree->allocator;
+    RbTree* t = new_tree_with_allocator(a);
+    if(!t) return NULL;
+    if(a->destroy) __atomic_add_fetch(&a->refs, 1, __ATOMIC_RELAXED);
+    t->augment = tree->augment;
+    return t;
+}
+
+/**
+ * 销毁整棵树
+ * 如果分配器支持整体释放（slab）并且没有其他树在使用，直接把所有 slab 还给系统；
+ * 否则借助 parent 指针做非递归的后序遍历，逐个释放节点，不会因为树太深而栈溢出
+ */
+void destroy_tree(RbTree* tree){
+    if(!tree) return;
+    relayout_cancel(tree);
+    NodeAllocator* a = tree->allocator;
+    int shared = a->destroy && __atomic_sub_fetch(&a->refs, 1, __ATOMIC_ACQ_REL) > 0;
+    if(a->release && !shared){
+        a->release(a);
+    } else {
+        TNode* n = tree->root;
+        while(n){
+            if(n->left){
+                n = n->left;
+            } else if(n->right){
+                n = n->right;
+            } else {
+                // 叶子节点，释放之后回到父节点，并断开父节点指向它的指针
+                TNode* p = n->parent;
+                if(p){
+                    if(p->left == n) p->left = NULL;
+                    else p->right = NULL;
+                }
+                a->free(a, n);
+                n = p;
+            }
+        }
+    }
+
+    if(a->destroy && !shared) a->destroy(a);
+    free(tree->pending);
+#ifdef RB_STATS
+    free(tree->stats);
+#endif
+    free(tree);
+}
+
 /**
  *  左旋
  *         n1                                    n1
@@ -103,6 +404,13 @@ void left_rotate(RbTree *tree, TNode* node){
     if(rNode->left) rNode->left->parent = node;
     rNode->left = node;
     node->parent = rNode; 
+    STAT_ADD(tree, left_rotations, 1);
+
+    // node 变成了 rNode 的孩子，先更新 node 再更新 rNode
+    if(tree->augment){
+        tree->augment->update(node);
+        tree->augment->update(rNode);
+    }
 }
 
 /**
@@ -136,12 +444,29 @@ void right_rotate(RbTree *tree, TNode* node){
     if(lNode->right) lNode->right->parent = node;
     lNode->right = node;
     node->parent = lNode;
+    STAT_ADD(tree, right_rotations, 1);
+
+    if(tree->augment){
+        tree->augment->update(node);
+        tree->augment->update(lNode);
+    }
+}
+
+// 从 node 开始沿着父节点向上，重新计算每个节点的附加信息，直到根节点
+void augment_propagate(RbTree *tree, TNode *node){
+    if(!tree->augment) return;
+    while(node){
+        tree->augment->update(node);
+        node = node->parent;
+    }
 }
 
 void insert_adjust(RbTree *tree, TNode *node){
+    STAT_ADD(tree, insert_fixups, 1);
     // case 1 如果 node 的 parent 为空，则表示是根节点，直接改为黑节点（BLACK）即可；
     if(node->parent == NULL){
         node->color = BLACK;
+        STAT_ADD(tree, recolors, 1);
     } else {
         if (node->parent->color == BLACK) {
             // case 2，节点的父节点是黑色节点，则不需要做任何移动，因为对任何规则都没有破坏
@@ -162,6 +487,7 @@ void insert_adjust(RbTree *tree, TNode *node){
                 gNode->color = RED;
                 node->parent->color = BLACK;
                 uNode->color = BLACK;
+                STAT_ADD(tree, recolors, 3);
 
                 // 由于 grand parent 变为了 RED，则有可能破坏了根节点为黑节点以及不能连续两个红节点的性质，
                 // 所以需要对其重新进行调整，其他的已经满足了
@@ -184,6 +510,7 @@ void insert_adjust(RbTree *tree, TNode *node){
                 // 再经过一次旋转，就能满足红黑树的性质
                 node->parent->color = BLACK;
                 gNode->color = RED;
+                STAT_ADD(tree, recolors, 2);
                 // 5.1 同为右节点
                 if(node == node->parent->right && node->parent == gNode->right){
                     left_rotate(tree, gNode);
@@ -198,46 +525,252 @@ void insert_adjust(RbTree *tree, TNode *node){
     }
 }
 
-int insert(RbTree *tree, int value){
+/**
+ * 由有序数组 keys[lo, hi] 递归构造一棵子树，每次取中点作为根，左右子树的节点数最多相差 1，
+ * 因此所有空叶子的深度只可能是 floor(log2(n+1)) 或者再深一层，
+ * 只要把深度为 red_depth = floor(log2(n+1)) 的节点（最深的不完整的那一层）染成红色，其余都为黑色，
+ * 就满足了所有路径上黑色节点个数相同的性质，整个过程不需要比较，也不需要旋转
+ */
+TNode* build_subtree(TNode* nodes, const int* keys, int lo, int hi, TNode* parent, int depth, int red_depth){
+    if(lo > hi) return NULL;
+    int mid = lo + (hi - lo) / 2;
+    TNode* node = &nodes[mid];
+    node->value = keys[mid];
+    node->color = depth == red_depth ? RED : BLACK;
+    node->parent = parent;
+    node->left = build_subtree(nodes, keys, lo, mid - 1, node, depth + 1, red_depth);
+    node->right = build_subtree(nodes, keys, mid + 1, hi, node, depth + 1, red_depth);
+    return node;
+}
+
+/**
+ * 由严格递增的 keys 在 O(n) 时间内构造一棵红黑树
+ * 所有节点分配在同一块连续内存中（树使用 slab 分配器，这块内存作为其中一个 slab），
+ * 之后的插入、删除与普通的树完全一样
+ */
+RbTree* build_from_sorted(const int* keys, int n){
+    NodeAllocator* allocator = new_slab_allocator(0);
+    if(!allocator) return NULL;
+    RbTree* tree = new_tree_with_allocator(allocator);
+    if(n <= 0) return tree;
+
+    TNode* nodes = slab_reserve(allocator, n);
+    if(!nodes){
+        perror("create nodes error.");
+        destroy_tree(tree);
+        return NULL;
+    }
+
+    int red_depth = 0;
+    while((2L << red_depth) <= (long) n + 1) ++red_depth;
+    tree->root = build_subtree(nodes, keys, 0, n - 1, NULL, 0, red_depth);
+    tree->size = n;
+    tree->leftmost = &nodes[0];
+    tree->rightmost = &nodes[n - 1];
+    return tree;
+}
+
+// ------------------------- 宽松平衡 -------------------------
+// 宽松模式下插入只把新节点挂上去，和父节点形成的连续红色记录在 pending 中，之后由 rebalance_step 逐步修复。
+// 插入的节点都是红色的，黑高始终满足，树中唯一可能被破坏的性质是连续的红色
+
+// node 与父节点都是红色
+static int is_violation(const TNode* node){
+    return node->color == RED && node->parent && node->parent->color == RED;
+}
+
+/**
+ * 修复 node 处的连续红色：每次找到 node 到根的路径上最靠上的冲突，从它开始做 insert_adjust。
+ * 最靠上的冲突之上没有连续的红色，它的祖父一定是黑色，insert_adjust 的前提成立；
+ * 改色和旋转只会消除冲突，或者把下面已有的冲突挂到另一个红色节点下，这些节点本来就记录在 pending 中
+ */
+static void fix_violation(RbTree* tree, TNode* node){
+    while(is_violation(node)){
+        TNode *top = node, *a;
+        for(a = node->parent; a->parent; a = a->parent)
+            if(is_violation(a)) top = a;
+        insert_adjust(tree, top);
+    }
+}
+
+/**
+ * 最多处理 budget 条记录，已经不再冲突的记录（被之前的修复顺带解决了）直接丢弃，也计入 budget
+ * @return 剩余的记录个数
+ */
+size_t rebalance_step(RbTree* tree, size_t budget){
     if(!tree) return 0;
-    TNode *node = new_node(value);
-    if(!tree->root){
+    while(budget && tree->pending_count){
+        fix_violation(tree, tree->pending[--tree->pending_count]);
+        --budget;
+    }
+    return tree->pending_count;
+}
+
+void rebalance_all(RbTree* tree){
+    rebalance_step(tree, (size_t) -1);
+}
+
+/**
+ * limit > 0 时进入（或调整）宽松模式，最多记录 limit 个冲突，满了之后每次插入先修复一个，
+ * 冲突越多查找路径越长，树高不超过 2 * 黑高 + 路径上的冲突数；limit 为 0 时修复所有冲突，回到严格模式
+ * @return 0 成功，-1 内存不足（模式不变）
+ */
+int set_relaxed(RbTree* tree, size_t limit){
+    if(!tree) return -1;
+    if(tree->pending_count > limit) rebalance_step(tree, tree->pending_count - limit);
+    if(!limit){
+        free(tree->pending);
+        tree->pending = NULL;
+        tree->pending_limit = 0;
+        return 0;
+    }
+    TNode** pending = (TNode**) realloc(tree->pending, limit * sizeof(TNode*));
+    if(!pending){
+        perror("set relaxed error.");
+        return -1;
+    }
+    tree->pending = pending;
+    tree->pending_limit = limit;
+    return 0;
+}
+
+// 记录一个冲突，pending 满了就先修复一个（修复时的旋转可能已经顺带解决了 node 的冲突）
+static void push_violation(RbTree* tree, TNode* node){
+    if(tree->pending_count == tree->pending_limit) rebalance_step(tree, 1);
+    if(is_violation(node)) tree->pending[tree->pending_count++] = node;
+}
+
+// node 即将被回收，去掉 pending 中指向它的记录
+static void drop_violation(RbTree* tree, const TNode* node){
+    size_t i = 0;
+    while(i < tree->pending_count){
+        if(tree->pending[i] == node) tree->pending[i] = tree->pending[--tree->pending_count];
+        else ++i;
+    }
+}
+
+/**
+ * 把新节点挂到 parent 下（parent 为空表示空树），然后更新附加信息并调整颜色
+ * 调用方需要保证 parent 就是查找 node->value 时走到的最后一个节点
+ */
+void attach_node(RbTree *tree, TNode *parent, TNode *node){
+    if(!parent){
         tree->root = node;
+        tree->leftmost = tree->rightmost = node;
+    } else if(node->value > parent->value){
+        parent->right = node;
+        if(parent == tree->rightmost) tree->rightmost = node;
     } else {
-        TNode *p, *t = tree->root;
-        while(t){
-            if(value == t->value) {
-                printf("value[%d] exists.", value);
-                return 0;
-            }
-            p = t;
-            if(value > t->value){
-                t = t->right;
-            } else {
-                t = t->left;
-            }
-        }
+        parent->left = node;
+        if(parent == tree->leftmost) tree->leftmost = node;
+    }
+    node->parent = parent;
 
-        if(value > p->value){
-            p->right = node;
-        }else{
-            p->left = node;
-        }
-        
-        node->parent = p;
+    // 新节点所在路径上所有节点的附加信息都发生了变化
+    augment_propagate(tree, node);
+
+    if(tree->pending && is_violation(node)){
+        push_violation(tree, node);
+        tree->size++;
+        return;
     }
 
     // 调整树节点，使其保持红黑树的性质
+#ifdef RB_STATS
+    unsigned long fixups = __atomic_load_n(&stats_slot(tree)->insert_fixups, __ATOMIC_RELAXED);
     insert_adjust(tree, node);
+    STAT_HIST(tree, insert_fixup_depth, __atomic_load_n(&stats_slot(tree)->insert_fixups, __ATOMIC_RELAXED) - fixups);
+#else
+    insert_adjust(tree, node);
+#endif
+
+    tree->size++;
+}
 
+TNode* finger_start(const RbTree* tree, TNode* finger, int value);
+
+/**
+ * 从 start 所在的子树向下查找 value，调用方需要保证 value 落在 start 子树的范围内
+ * @return 找到的节点；不存在时返回 NULL，*parent 为插入位置的父节点
+ */
+static TNode* find_slot(TNode* start, int value, TNode** parent){
+    TNode *p = NULL, *t = start;
+    while(t){
+        if(value == t->value) return t;
+        p = t;
+        if(value > t->value){
+            t = t->right;
+        } else {
+            t = t->left;
+        }
+    }
+    *parent = p;
+    return NULL;
+}
+
+/**
+ * 将一个已经初始化好的节点（value、附加信息）插入树中
+ * @return 1 插入成功，0 表示 value 已经存在，node 没有被使用，由调用方释放
+ */
+int insert_node(RbTree *tree, TNode *node){
+    TNode *p = NULL;
+    if(find_slot(tree->root, node->value, &p)) return 0;
+    attach_node(tree, p, node);
     return 1;
 }
 
-typedef enum Order{
-    pre,    // 先序
-    post,   // 后序
-    middle  // 中序
-} Order;
+// 在 parent 下新建 value 的节点，parent 是 find_slot 给出的位置
+static TNode* attach_value(RbTree *tree, TNode *parent, int value){
+    TNode *node = alloc_node(tree, value);
+    if(!node) return NULL;
+    if(tree->augment) tree->augment->update(node);
+    attach_node(tree, parent, node);
+    return node;
+}
+
+/**
+ * 查找 value，不存在时插入，只从根向下走一遍，只有真正插入时才申请节点
+ * 新节点的附加信息由 augment->update 初始化，区间树需要设置右端点时使用 upsert_interval
+ * @inserted 可以为空，返回时为 1 表示新插入，0 表示已经存在
+ * @return value 所在的节点，内存不足时返回 NULL
+ */
+TNode* find_or_insert(RbTree *tree, int value, int *inserted){
+    TNode *p = NULL, *n;
+    if(inserted) *inserted = 0;
+    if(!tree) return NULL;
+    n = find_slot(tree->root, value, &p);
+    if(n) return n;
+    n = attach_value(tree, p, value);
+    if(n && inserted) *inserted = 1;
+    return n;
+}
+
+int insert(RbTree *tree, int value){
+    int inserted;
+    return find_or_insert(tree, value, &inserted) && inserted;
+}
+
+/**
+ * 带位置提示的插入，hint 一般是上一次插入返回的节点，语义与 find_or_insert 相同
+ * value 大于 hint 时从 hint 向上回溯到范围包含 value 的最近的祖先（同 apply_batch 的 finger），再从那里向下查找；
+ * hint 是最大的节点时直接挂在它的右边，不需要任何比较。按升序追加 key 时每次都是这种情况，
+ * 插入调整的均摊代价也是 O(1)，所以整个插入均摊 O(1)。value 不大于 hint 或者 hint 为空时从根查找
+ * @return value 所在的节点，可以作为下一次的 hint，内存不足时返回 NULL
+ */
+TNode* insert_hint(RbTree *tree, TNode *hint, int value){
+    TNode *p = NULL, *n;
+    if(!tree) return NULL;
+    if(!hint || value <= hint->value){
+        if(hint && value == hint->value) return hint;
+        n = find_slot(tree->root, value, &p);
+    } else if(hint == tree->rightmost){
+        n = NULL;
+        p = hint;
+    } else {
+        n = find_slot(finger_start(tree, hint, value), value, &p);
+    }
+    return n ? n : attach_value(tree, p, value);
+}
 
 // 递归中序遍历树
 void visit_node(const TNode * n, Order order, int depth){
@@ -298,6 +831,7 @@ void delete_adjust(RbTree * tree, TNode* parentNode, TNode* childNode){
 
     // 如果子节点是空或者子节点是黑色 且 子节点不是根节点(只要子节点不是根节点，则父节点必然存在)
     while((!childNode || childNode->color == BLACK) && childNode != tree->root){
+        STAT_ADD(tree, delete_fixups, 1);
         // 如果子节点是左孩子
         if(childNode == parentNode->left) {
             brother = parentNode->right;
@@ -312,6 +846,7 @@ void delete_adjust(RbTree * tree, TNode* parentNode, TNode* childNode){
             if(brother->color == RED){
                 brother->color = BLACK;
                 parentNode->color = RED;
+                STAT_ADD(tree, recolors, 2);
                 left_rotate(tree, parentNode);
                 // parentNode->right 会指向 brother 的左节点
                 brother = parentNode->right;
@@ -325,6 +860,7 @@ void delete_adjust(RbTree * tree, TNode* parentNode, TNode* childNode){
              */
             if((!brother->left || brother->left->color == BLACK) && (!brother->right || brother->right->color == BLACK)){
                 brother->color = RED;
+                STAT_ADD(tree, recolors, 1);
                 childNode = parentNode;
                 parentNode = parentNode->parent;
             }else{
@@ -341,6 +877,7 @@ void delete_adjust(RbTree * tree, TNode* parentNode, TNode* childNode){
                     if((oLeft = brother->left))
                         oLeft->color = BLACK;
                     brother->color = RED;
+                    STAT_ADD(tree, recolors, 2);
                     right_rotate(tree, brother);
                     brother = parentNode->right;
                 }
@@ -358,6 +895,7 @@ void delete_adjust(RbTree * tree, TNode* parentNode, TNode* childNode){
                 parentNode->color = BLACK;
                 if(brother->right)
                     brother->right->color = BLACK;
+                STAT_ADD(tree, recolors, 3);
                 left_rotate(tree, parentNode);
                 childNode = tree->root;
                 break;
@@ -368,12 +906,14 @@ void delete_adjust(RbTree * tree, TNode* parentNode, TNode* childNode){
             if(brother->color == RED){
                 brother->color = BLACK;
                 parentNode->color = RED;
+                STAT_ADD(tree, recolors, 2);
                 right_rotate(tree, parentNode);
                 // parentNode->right 会指向 brother 的左节点
                 brother = parentNode->left;
             }
             if((!brother->right || brother->right->color == BLACK) && (!brother->left || brother->left->color == BLACK)){
                 brother->color = RED;
+                STAT_ADD(tree, recolors, 1);
                 childNode = parentNode;
                 parentNode = parentNode->parent;
             }else{
@@ -382,6 +922,7 @@ void delete_adjust(RbTree * tree, TNode* parentNode, TNode* childNode){
                     if((oRight = brother->right))
                         oRight->color = BLACK;
                     brother->color = RED;
+                    STAT_ADD(tree, recolors, 2);
                     left_rotate(tree, brother);
                     brother = parentNode->left;
                 }
@@ -390,6 +931,7 @@ void delete_adjust(RbTree * tree, TNode* parentNode, TNode* childNode){
                 parentNode->color = BLACK;
                 if(brother->left)
                     brother->left->color = BLACK;
+                STAT_ADD(tree, recolors, 3);
                 right_rotate(tree, parentNode);
                 childNode = tree->root;
                 break;
@@ -398,13 +940,49 @@ void delete_adjust(RbTree * tree, TNode* parentNode, TNode* childNode){
     }
 
     // 子节点的颜色调成黑色，让当前分支的黑色个数保持不变（因为删除的是黑色节点）
-    if(childNode) childNode->color = BLACK;
+    if(childNode){
+        childNode->color = BLACK;
+        STAT_ADD(tree, recolors, 1);
+    }
+}
+
+/**
+ * 树的高度（最长的根到叶子路径上的节点数），借助 parent 指针非递归遍历
+ */
+int tree_height(const RbTree* tree){
+    if(!tree || !tree->root) return 0;
+    const TNode *n = tree->root, *prev = NULL;
+    int depth = 1, height = 0;
+    while(n){
+        if(prev == n->parent){
+            prev = n;
+            if(depth > height) height = depth;
+            if(n->left){ n = n->left; ++depth; }
+            else if(n->right){ n = n->right; ++depth; }
+            else { n = n->parent; --depth; }
+        } else if(prev == n->left && n->right){
+            prev = n;
+            n = n->right;
+            ++depth;
+        } else {
+            prev = n;
+            n = n->parent;
+            --depth;
+        }
+    }
+    return height;
 }
 
 TNode * search_node(RbTree * tree, int value){
     if(!tree) return NULL;
     TNode* target = tree->root;
+#ifdef RB_STATS
+    int depth = 0;
+#endif
     while(target && target->value != value){
+#ifdef RB_STATS
+        depth++;
+#endif
         if(value < target->value){
             target = target->left;
         }else{
@@ -412,9 +990,206 @@ TNode * search_node(RbTree * tree, int value){
         }
     }
 
+#ifdef RB_STATS
+    if(target) depth++;   // 命中的节点也比较了一次
+    STAT_ADD(tree, searches, 1);
+    STAT_ADD(tree, comparisons, depth);
+    STAT_HIST(tree, search_depth, depth);
+#endif
     return target;
 }
 
+/**
+ * 批量查找，out[i] 为 keys[i] 的节点，不存在时为空，结果与逐个 search_node 相同
+ * 一次查找每向下一层都可能是一次 cache miss，而且下一层的地址要等这次访存结束才知道，逐个查找时这些 miss 只能串行等待。
+ * 这里同时推进 RB_SEARCH_LANES 个互不相关的查找：每个查找走一层后预取下一个节点就换到下一个查找，
+ * 某个查找结束时立即换上下一个 key，不必等同一组中最长的路径走完，多个查找的 miss 因此重叠在一起
+ * @return 找到的 key 的个数
+ */
+size_t search_many(RbTree * tree, const int* keys, size_t n, TNode** out){
+    TNode* cur[RB_SEARCH_LANES];
+    size_t idx[RB_SEARCH_LANES];
+    size_t lanes = 0, live, next = 0, found = 0, l;
+#ifdef RB_STATS
+    unsigned long comparisons = 0;
+    int depth[RB_SEARCH_LANES];   // 每个查找已经比较过的节点数，结束时与 search_node 一样记入 search_depth
+#endif
+    if(!tree || !n) return 0;
+    while(lanes < RB_SEARCH_LANES && next < n){
+#ifdef RB_STATS
+        depth[lanes] = 0;
+#endif
+        cur[lanes] = tree->root;
+        idx[lanes++] = next++;
+    }
+    live = lanes;
+
+    while(live){
+        for(l = 0; l < lanes; ++l){
+            TNode* c = cur[l];
+            if(idx[l] == (size_t) -1) continue;
+            int value = keys[idx[l]];
+            if(!c || c->value == value){
+#ifdef RB_STATS
+                depth[l] += c != NULL;
+                comparisons += depth[l];
+                STAT_HIST(tree, search_depth, depth[l]);
+                depth[l] = 0;
+#endif
+                out[idx[l]] = c;
+                found += c != NULL;
+                if(next < n){
+                    cur[l] = tree->root;
+                    idx[l] = next++;
+                } else {
+                    idx[l] = (size_t) -1;
+                    --live;
+                }
+                continue;
+            }
+#ifdef RB_STATS
+            depth[l]++;
+#endif
+            c = value < c->value ? c->left : c->right;
+            if(c) __builtin_prefetch(c);
+            cur[l] = c;
+        }
+    }
+
+#ifdef RB_STATS
+    STAT_ADD(tree, searches, n);
+    STAT_ADD(tree, comparisons, comparisons);
+#endif
+    return found;
+}
+
+// 最小、最大的节点，直接读缓存，O(1)
+TNode* tree_min(const RbTree* tree){
+    return tree ? tree->leftmost : NULL;
+}
+
+TNode* tree_max(const RbTree* tree){
+    return tree ? tree->rightmost : NULL;
+}
+
+/**
+ * 取出并删除最小的 key，用作优先队列（例如定时器按到期时间排序）
+ * 最小的节点没有左孩子，摘除时不需要查找，新的最小节点是它的右孩子（只可能是红色叶子）或者父节点
+ * @return 1 成功，0 树为空
+ */
+int tree_pop_min(RbTree* tree, int* value){
+    TNode* n = tree_min(tree);
+    if(!n) return 0;
+    if(value) *value = n->value;
+    erase_node(tree, n);
+    return 1;
+}
+
+int tree_pop_max(RbTree* tree, int* value){
+    TNode* n = tree_max(tree);
+    if(!n) return 0;
+    if(value) *value = n->value;
+    erase_node(tree, n);
+    return 1;
+}
+
+// ------------------------- 有序遍历 -------------------------
+// 以下函数只依赖 parent 指针，不递归、不申请内存
+
+TNode* first_node(const RbTree* tree){
+    if(!tree || !tree->root) return NULL;
+    TNode* n = tree->root;
+    while(n->left) n = n->left;
+    return n;
+}
+
+TNode* last_node(const RbTree* tree){
+    if(!tree || !tree->root) return NULL;
+    TNode* n = tree->root;
+    while(n->right) n = n->right;
+    return n;
+}
+
+// 中序遍历的后继：右子树的最小节点，或者第一个从左子树回溯上来的祖先
+TNode* next_node(const TNode* n){
+    if(!n) return NULL;
+    if(n->right){
+        n = n->right;
+        while(n->left) n = n->left;
+        return (TNode*) n;
+    }
+    while(n->parent && n == n->parent->right) n = n->parent;
+    return n->parent;
+}
+
+TNode* prev_node(const TNode* n){
+    if(!n) return NULL;
+    if(n->left){
+        n = n->left;
+        while(n->right) n = n->right;
+        return (TNode*) n;
+    }
+    while(n->parent && n == n->parent->left) n = n->parent;
+    return n->parent;
+}
+
+// 第一个 >= value 的节点
+TNode* lower_bound(const RbTree* tree, int value){
+    if(!tree) return NULL;
+    TNode *n = tree->root, *r = NULL;
+    while(n){
+        if(n->value >= value){
+            r = n;
+            n = n->left;
+        } else {
+            n = n->right;
+        }
+    }
+    return r;
+}
+
+// 第一个 > value 的节点
+TNode* upper_bound(const RbTree* tree, int value){
+    if(!tree) return NULL;
+    TNode *n = tree->root, *r = NULL;
+    while(n){
+        if(n->value > value){
+            r = n;
+            n = n->left;
+        } else {
+            n = n->right;
+        }
+    }
+    return r;
+}
+
+/**
+ * 按升序扫描闭区间 [lo, hi] 内的所有 key，O(log n + k)
+ * key 先攒到调用方提供的 buf（容量为 batch）中，满了再一次性交给 callback，摊薄每个元素的调用开销
+ * @return 扫描到的 key 的个数
+ */
+size_t range_scan(const RbTree* tree, int lo, int hi, int* buf, size_t batch, ScanCallback callback, void* ctx){
+    size_t total = 0, cnt = 0;
+    if(!buf || !batch || lo > hi) return 0;
+
+    const TNode* n = lower_bound(tree, lo);
+    while(n && n->value <= hi){
+        buf[cnt++] = n->value;
+        if(cnt == batch){
+            total += cnt;
+            cnt = 0;
+            if(callback(buf, batch, ctx)) return total;
+        }
+        n = next_node(n);
+    }
+
+    if(cnt){
+        total += cnt;
+        callback(buf, cnt, ctx);
+    }
+    return total;
+}
+
 /**
  * 删除节点
  * 核心思路：（https://zh.wikipedia.org/wiki/%E7%BA%A2%E9%BB%91%E6%A0%91）
@@ -442,6 +1217,27 @@ int delete_node(RbTree * tree, int value){
         return 0;
     }
 
+    erase_node(tree, delNode);
+    return 1;
+}
+
+/**
+ * 从树中摘除并回收 delNode，delNode 必须在树中，其余节点的指针在删除后依然有效
+ */
+void erase_node(RbTree * tree, TNode * delNode){
+    TNode * moved = NULL;  // 替换到 delNode 位置上的节点
+    if(delNode == tree->leftmost) tree->leftmost = next_node(delNode);
+    if(delNode == tree->rightmost) tree->rightmost = prev_node(delNode);
+    if(tree->pending_count){
+        // 宽松模式下实际摘除的节点为黑色时需要 delete_adjust，它要求没有连续的红色，先修复所有冲突；
+        // 为红色时不需要调整，只要去掉指向 delNode 的记录
+        TNode * removed = delNode;
+        if(removed->left && removed->right)
+            for(removed = removed->right; removed->left; removed = removed->left);
+        if(removed->color == BLACK) rebalance_all(tree);
+        else drop_violation(tree, delNode);
+    }
+
     // 2. 如果左右子树都不为空的情况下，我们需要找到替换的节点，进而将包含两个非空子节点的问题，转换成最多包含一个非空节点的问题，
     // 这里有两种方案，一种是找左子树的最大值，另一种是找右子树的最小值，在这里，我们查找右子树的最小值
     TNode * child = NULL,* parent = NULL;
@@ -453,6 +1249,8 @@ int delete_node(RbTree * tree, int value){
 
         delColor = minRightNode->color;
         parent = minRightNode->parent;
+        // minRightNode 就是 delNode 的右孩子时，替换之后 child 的父节点是 minRightNode 本身
+        if(parent == delNode) parent = minRightNode;
 
         child = minRightNode->right; // minRightNode->left must be NULL
         if(child) { // 如果子节点不为空，移除 minRightNode 所在的位置
@@ -486,6 +1284,7 @@ int delete_node(RbTree * tree, int value){
         delNode->left->parent = minRightNode;
         if(delNode->right)
             delNode->right->parent = minRightNode;
+        moved = minRightNode;
     }else{
         if(!delNode->left) child = delNode->right;
         else if(!delNode->right) child = delNode->left;
@@ -508,53 +1307,480 @@ int delete_node(RbTree * tree, int value){
         }
     }
 
+    // 从实际被摘除的位置向上更新附加信息，替换到 delNode 位置上的 minRightNode 也在这条路径上
+    augment_propagate(tree, parent);
+
     // 若删除的节点的颜色是红色，则不需要关注，只有为黑色的节点，才需要进行颜色的调整
+#ifdef RB_STATS
+    unsigned long fixups = __atomic_load_n(&stats_slot(tree)->delete_fixups, __ATOMIC_RELAXED);
+    if(delColor == BLACK)
+        delete_adjust(tree, parent, child);
+    STAT_HIST(tree, delete_fixup_depth, __atomic_load_n(&stats_slot(tree)->delete_fixups, __ATOMIC_RELAXED) - fixups);
+#else
     if(delColor == BLACK)
         delete_adjust(tree, parent, child);
+#endif
+
+    // 宽松模式下，替换上来的节点带着 delNode 的红色，可能和新的父节点形成连续的红色
+    if(tree->pending && moved && is_violation(moved)) push_violation(tree, moved);
+
+    free_node(tree, delNode);
+    tree->size--;
+}
+
+// ------------------------- 内存重排 -------------------------
+// 随机的插入、删除之后，相邻的节点在内存中相距很远，查找和遍历几乎每一步都 cache miss。
+// relayout 把所有节点按 BFS 或 vEB 顺序复制到一整块新申请的连续内存中，树的逻辑结构（key、颜色、形状、附加信息）不变，
+// 被搬动的节点通过 MovedCallback 告知调用方。树只被这一棵使用的 slab 分配器在搬完之后把旧的 slab 整体还给系统，
+// 因此调用方 alloc_node 之后还没有挂到树上的节点不能跨过 relayout 保留。
+
+// relayout_step 的一轮整理：nodes[0, count) 是已经搬过来的节点，其中 nodes[0, scan) 的孩子也都搬过了
+typedef struct Relayout{
+    TNode* nodes;
+    size_t cap;
+    size_t count;
+    size_t scan;
+} Relayout;
+
+static int in_block(const Relayout* r, const TNode* n){
+    return n >= r->nodes && n < r->nodes + r->cap;
+}
+
+// 整体重排时把 n 复制到下一个位置，原节点的 parent 改为指向副本，之后据此修正指针
+static void copy_out(Relayout* r, TNode* n){
+    TNode* c = &r->nodes[r->count++];
+    *c = *n;
+    n->parent = c;
+}
+
+// 以 n 为根、深度小于 levels 的部分按 vEB 顺序复制：先复制上面 levels / 2 层，再依次复制下面的每棵子树
+static void veb_bottom(Relayout* r, TNode* n, int depth, int levels);
+
+static void veb_copy(Relayout* r, TNode* n, int levels){
+    if(!n) return;
+    if(levels == 1){
+        copy_out(r, n);
+        return;
+    }
+    veb_copy(r, n, levels / 2);
+    veb_bottom(r, n, levels / 2, levels - levels / 2);
+}
+
+// n 之下深度为 depth 的节点从左到右各自作为根，复制 levels 层
+static void veb_bottom(Relayout* r, TNode* n, int depth, int levels){
+    if(!n) return;
+    if(!depth){
+        veb_copy(r, n, levels);
+        return;
+    }
+    veb_bottom(r, n->left, depth - 1, levels);
+    veb_bottom(r, n->right, depth - 1, levels);
+}
+
+/**
+ * 把所有节点按 order 搬到同一个 slab 分配器中的一块新的连续内存中，搬完后每个原节点都会通过 moved（可以为空）报告一次
+ * 只支持 slab 分配器：其他分配器可能与别的树共用，不能替换，也拿不到连续的内存
+ * @return 0 成功，-1 分配器不是 slab 或者内存不足（树不变）
+ */
+int relayout(RbTree* tree, RelayoutOrder order, MovedCallback moved, void* ctx){
+    NodeAllocator* a;
+    Relayout r;
+    size_t i;
+    if(!tree || tree->allocator->alloc != slab_alloc) return -1;
+    relayout_cancel(tree);
+    rebalance_all(tree);
+    if(!tree->root) return 0;
+
+    a = tree->allocator;
+    r.nodes = slab_reserve(a, tree->size);
+    if(!r.nodes){
+        perror("relayout error.");
+        return -1;
+    }
+    r.cap = tree->size;
+    r.count = 0;
+
+    TNode* root = tree->root;
+    if(order == RELAYOUT_VEB){
+        veb_copy(&r, root, tree_height(tree));
+    } else {
+        // 副本的 left/right 还指向原节点，已复制的部分本身就是 BFS 的队列
+        copy_out(&r, root);
+        for(i = 0; i < r.count; ++i){
+            if(r.nodes[i].left) copy_out(&r, r.nodes[i].left);
+            if(r.nodes[i].right) copy_out(&r, r.nodes[i].right);
+        }
+    }
+
+    // 除根以外每个原节点恰好是一个副本的孩子，在那里换成它的副本并回收，与排列顺序无关
+    for(i = 0; i < r.count; ++i){
+        TNode* c = &r.nodes[i];
+        TNode* from;
+        if((from = c->left)){
+            c->left = from->parent;
+            c->left->parent = c;
+            if(moved) moved(from, c->left, ctx);
+            a->free(a, from);
+        }
+        if((from = c->right)){
+            c->right = from->parent;
+            c->right->parent = c;
+            if(moved) moved(from, c->right, ctx);
+            a->free(a, from);
+        }
+    }
+    tree->root = root->parent;
+    tree->root->parent = NULL;
+    if(moved) moved(root, tree->root, ctx);
+    a->free(a, root);
+    tree->leftmost = first_node(tree);
+    tree->rightmost = last_node(tree);
+
+    if(__atomic_load_n(&a->refs, __ATOMIC_RELAXED) <= 1) slab_keep(a, r.nodes, r.count);
+    return 0;
+}
+
+// 把 n 搬到下一个位置，立即修正父节点、孩子和树中指向它的指针
+static void move_node(RbTree* tree, Relayout* r, TNode* n, MovedCallback moved, void* ctx){
+    TNode* c = &r->nodes[r->count++];
+    *c = *n;
+    if(!c->parent) tree->root = c;
+    else if(c->parent->left == n) c->parent->left = c;
+    else c->parent->right = c;
+    if(c->left) c->left->parent = c;
+    if(c->right) c->right->parent = c;
+    if(tree->leftmost == n) tree->leftmost = c;
+    if(tree->rightmost == n) tree->rightmost = c;
+    if(moved) moved(n, c, ctx);
+    tree->allocator->free(tree->allocator, n);
+}
+
+// 结束一轮整理：没用到的位置交还分配器，所有节点都已搬过来并且分配器只有这棵树在用时回收旧的 slab
+static void relayout_finish(RbTree* tree){
+    Relayout* r = tree->relayout;
+    NodeAllocator* a = tree->allocator;
+    while(r->cap > r->count) a->free(a, &r->nodes[--r->cap]);
+    if(r->count == tree->size && __atomic_load_n(&a->refs, __ATOMIC_RELAXED) <= 1)
+        slab_keep(a, r->nodes, r->count);
+    free(r);
+    tree->relayout = NULL;
+}
+
+/**
+ * 增量重排，按 BFS 顺序（用已经搬过来的节点作为队列）每次处理 budget 个节点，每个节点搬过来时立即修正所有指向它的指针，
+ * 两次调用之间树可以正常使用。只支持 slab 分配器（其他分配器什么都不做，返回 0），每次调用前先修复宽松模式下的所有冲突。
+ * 两次调用之间插入的节点可能没有被搬动，只影响排列效果；回收节点（删除、tree_join 等）会放弃这一轮，已经搬过的节点留在原处
+ * @return 本次处理的节点个数，返回 0 表示这一轮已经结束（或者内存不足），再次调用开始新的一轮
+ */
+size_t relayout_step(RbTree* tree, size_t budget, MovedCallback moved, void* ctx){
+    Relayout* r;
+    size_t done = 0;
+    if(!tree || !budget || tree->allocator->alloc != slab_alloc) return 0;
+    rebalance_all(tree);
+    r = tree->relayout;
+    if(!r){
+        if(!tree->root) return 0;
+        r = (Relayout*) malloc(sizeof(Relayout));
+        if(!r){
+            perror("relayout error.");
+            return 0;
+        }
+        r->nodes = slab_reserve(tree->allocator, tree->size);
+        if(!r->nodes){
+            perror("relayout error.");
+            free(r);
+            return 0;
+        }
+        r->cap = tree->size;
+        r->count = r->scan = 0;
+        tree->relayout = r;
+        move_node(tree, r, tree->root, moved, ctx);
+    }
+
+    while(done < budget && r->scan < r->count){
+        TNode* n = &r->nodes[r->scan++];
+        if(n->left && !in_block(r, n->left) && r->count < r->cap) move_node(tree, r, n->left, moved, ctx);
+        if(n->right && !in_block(r, n->right) && r->count < r->cap) move_node(tree, r, n->right, moved, ctx);
+        ++done;
+    }
+    if(!done) relayout_finish(tree);
+    return done;
+}
+
+// 放弃进行中的一轮整理，已经搬过的节点留在原处，没用到的位置交还分配器
+void relayout_cancel(RbTree* tree){
+    Relayout* r;
+    if(!tree || !(r = tree->relayout)) return;
+    while(r->cap > r->count) tree->allocator->free(tree->allocator, &r->nodes[--r->cap]);
+    free(r);
+    tree->relayout = NULL;
+}
+
+// ------------------------- 批量修改 -------------------------
+
+/**
+ * 按 value 对 ops 做稳定的 LSD 基数排序（每轮 8 位，共 4 轮），相同 key 的操作保持原来的先后顺序
+ * @return 1 成功，0 内存不足（ops 不变）
+ */
+int sort_batch(BatchOp* ops, size_t n){
+    size_t i;
+    int shift;
+    BatchOp* tmp = (BatchOp*) malloc(n * sizeof(BatchOp));
+    if(!tmp){
+        perror("sort batch error.");
+        return 0;
+    }
 
-    free(delNode);
-    delNode = NULL;
+    BatchOp *src = ops, *dst = tmp;
+    for(shift = 0; shift < 32; shift += 8){
+        size_t count[257] = {0};
+        for(i = 0; i < n; ++i)
+            count[((((unsigned) src[i].value) ^ 0x80000000u) >> shift & 0xff) + 1]++;
+        for(i = 0; i < 256; ++i) count[i + 1] += count[i];
+        for(i = 0; i < n; ++i)
+            dst[count[(((unsigned) src[i].value) ^ 0x80000000u) >> shift & 0xff]++] = src[i];
+        BatchOp* t = src; src = dst; dst = t;
+    }
+    // 4 轮之后结果回到了 ops 中
+    free(tmp);
     return 1;
 }
 
-int main(int argc, char const *argv[]) {
-    printf("hello world, red-black tree. \n");
-    RbTree * tree = new_tree();
-    
-    while(1){
-        printf("input insert number...\n");
-        int nbr = 0;
-        scanf("%d", &nbr);
-        insert(tree,nbr);
-        visit_tree(tree, middle);
+/**
+ * 从上一次操作的位置（finger）出发，向上找到子树范围包含 value 的最近的祖先，作为这次查找的起点
+ * 批量中的 key 是递增的，finger 子树的下界一定小于 value，只需要保证上界：
+ * finger 是其父节点的左孩子并且 value 小于父节点时，value 一定落在 finger 的子树范围内
+ */
+TNode* finger_start(const RbTree* tree, TNode* finger, int value){
+    if(!finger) return tree->root;
+    while(finger->parent && !(finger == finger->parent->left && value < finger->parent->value))
+        finger = finger->parent;
+    return finger;
+}
+
+/**
+ * 批量应用插入/删除：先按 key 排序，再按升序和树一起向前推进，
+ * 每个 key 从上一个 key 所在的位置向上回溯到公共祖先再向下查找，而不是每次都从根节点开始，
+ * 相邻 key 共享的路径只访问一次，访问的节点也集中在树的局部，批量越大越接近一次顺序遍历。
+ * 每个操作完成后立即做插入/删除调整，平衡是逐步完成的。
+ * 批量相对树很稀疏时（相邻 key 的公共祖先接近根），回溯反而比直接从根查找多走一倍的路径，这时只利用排序带来的局部性。
+ * ops 会被原地排序，相同 key 的多个操作按原来的先后顺序执行
+ * @done    可以为空，排序后的 ops[0, *done) 已经执行，成功时为 n
+ * @applied 可以为空，实际修改了树的操作个数
+ * @return 0 成功，-1 内存不足：排序时失败则什么都没有执行（ops 不变），插入时失败则 ops[*done] 及之后的操作都没有执行
+ */
+int apply_batch(RbTree* tree, BatchOp* ops, size_t n, size_t* done, size_t* applied){
+    size_t i, changed = 0;
+    TNode* finger = NULL;
+    int ret = 0;
+    if(done) *done = 0;
+    if(applied) *applied = 0;
+    if(!tree || !ops || !n) return 0;
+    if(!sort_batch(ops, n)) return -1;
+    int use_finger = n * 8 >= tree->size;
+
+    for(i = 0; i < n; ++i){
+        int value = ops[i].value;
+        TNode *p = NULL, *t = use_finger ? finger_start(tree, finger, value) : tree->root;
+        while(t && t->value != value){
+            p = t;
+            t = value > t->value ? t->right : t->left;
+        }
 
-        if(nbr == -1) break;
+        if(ops[i].type == BATCH_INSERT){
+            if(t){
+                finger = t;
+                continue;
+            }
+            TNode* node = alloc_node(tree, value);
+            if(!node){
+                ret = -1;
+                break;
+            }
+            if(tree->augment) tree->augment->update(node);
+            attach_node(tree, p, node);
+            finger = node;
+            changed++;
+        } else {
+            if(!t){
+                finger = p;
+                continue;
+            }
+            // 删除后 t 失效，下一次从它的前驱开始（前驱在删除后依然有效）
+            finger = prev_node(t);
+            erase_node(tree, t);
+            changed++;
+        }
     }
+    if(done) *done = i;
+    if(applied) *applied = changed;
+    return ret;
+}
+
+/**
+ * 为树设置附加信息的维护方式，并借助 parent 指针非递归地后序遍历，重新计算所有节点
+ * 例如 build_from_sorted 之后再调用 set_augment(tree, &size_augment)
+ */
+void set_augment(RbTree* tree, const RbAugment* augment){
+    tree->augment = augment;
+    if(!augment || !tree->root) return;
 
-    printf("begin to delete... \n");
+    TNode *n = tree->root, *prev = NULL;
+    while(n){
+        if(prev == n->parent){
+            // 第一次到达 n，先处理左子树，再处理右子树
+            prev = n;
+            if(n->left) n = n->left;
+            else if(n->right) n = n->right;
+            else { augment->update(n); n = n->parent; }
+        } else if(prev == n->left && n->right){
+            prev = n;
+            n = n->right;
+        } else {
+            // 左右子树都处理完了
+            augment->update(n);
+            prev = n;
+            n = n->parent;
+        }
+    }
+}
+
+// ------------------------- 子树大小：rank/select -------------------------
+size_t subtree_size(const TNode* n){
+    return n ? n->aug.size : 0;
+}
+
+void size_update(TNode* n){
+    n->aug.size = 1 + subtree_size(n->left) + subtree_size(n->right);
+}
+
+const RbAugment size_augment = { size_update };
+
+/**
+ * 树中小于 value 的节点个数，O(log n)，需要树使用 size_augment
+ */
+size_t tree_rank(const RbTree* tree, int value){
+    size_t r = 0;
+    if(!tree || tree->augment != &size_augment) return 0;
+    TNode* n = tree->root;
+    while(n){
+        if(value <= n->value){
+            n = n->left;
+        } else {
+            r += 1 + subtree_size(n->left);
+            n = n->right;
+        }
+    }
+    return r;
+}
+
+/**
+ * 第 k 小的节点（k 从 1 开始），O(log n)，k 越界时返回 NULL，需要树使用 size_augment
+ */
+TNode* tree_select(const RbTree* tree, size_t k){
+    if(!tree || tree->augment != &size_augment) return NULL;
+    TNode* n = tree->root;
+    while(n){
+        size_t ls = subtree_size(n->left);
+        if(k == ls + 1) return n;
+        if(k <= ls){
+            n = n->left;
+        } else {
+            k -= ls + 1;
+            n = n->right;
+        }
+    }
+    return NULL;
+}
+
+// ------------------------- 区间树：max_end -------------------------
+// 节点表示闭区间 [value, aug.interval.end]，value 作为 key，因此起点不能重复
+void interval_update(TNode* n){
+    int m = n->aug.interval.end;
+    if(n->left && n->left->aug.interval.max_end > m) m = n->left->aug.interval.max_end;
+    if(n->right && n->right->aug.interval.max_end > m) m = n->right->aug.interval.max_end;
+    n->aug.interval.max_end = m;
+}
+
+const RbAugment interval_augment = { interval_update };
+
+int insert_interval(RbTree* tree, int start, int end){
+    TNode *p = NULL;
+    if(!tree || tree->augment != &interval_augment) return 0;
+    if(find_slot(tree->root, start, &p)) return 0;
+    TNode *node = alloc_node(tree, start);
+    if(!node) return 0;
+    node->aug.interval.end = node->aug.interval.max_end = end;
+    attach_node(tree, p, node);
+    return 1;
+}
+
+/**
+ * 插入区间 [start, end]，起点已经存在时把它的右端点改为 end，并沿父节点向上更新 max_end，只查找一遍
+ * @return 1 插入，0 更新，-1 内存不足
+ */
+int upsert_interval(RbTree* tree, int start, int end){
+    TNode *p = NULL, *n;
+    if(!tree || tree->augment != &interval_augment) return -1;
+    n = find_slot(tree->root, start, &p);
+    if(n){
+        n->aug.interval.end = end;
+        augment_propagate(tree, n);
+        return 0;
+    }
+    n = alloc_node(tree, start);
+    if(!n) return -1;
+    n->aug.interval.end = n->aug.interval.max_end = end;
+    attach_node(tree, p, n);
+    return 1;
+}
+
+// 在以 node 为根的子树中，查找起点最小的、与 [lo, hi] 相交的区间，要求 node->aug.interval.max_end >= lo
+TNode* interval_subtree_search(TNode* node, int lo, int hi){
     while(1){
-        printf("input deleted number...\n");
-        int nbr = 0;
-        scanf("%d", &nbr);
-        int r = delete_node(tree, nbr);
-        if(r == 0){
-            printf("not found %d\n", nbr);
+        if(node->left && node->left->aug.interval.max_end >= lo){
+            // 左子树中有右端点 >= lo 的区间，而左子树的起点都更小，如果有结果一定在左子树
+            node = node->left;
+            continue;
         }
-        visit_tree(tree, middle);
-    }
-    /*delete_node(tree, 11);
-    visit_tree(tree, middle);
-    delete_node(tree, 12);
-    visit_tree(tree, middle);
-    delete_node(tree, 5);
-    visit_tree(tree, middle);
-    delete_node(tree, 4);
-    visit_tree(tree, middle);
-    delete_node(tree, 3);
-    visit_tree(tree, middle);
-    delete_node(tree, 2);
-    visit_tree(tree, middle);
-    delete_node(tree, 1);
-    visit_tree(tree, middle);*/
-    return 0;
+        if(node->value <= hi){
+            if(node->aug.interval.end >= lo) return node;
+            if(node->right && node->right->aug.interval.max_end >= lo){
+                node = node->right;
+                continue;
+            }
+        }
+        return NULL;
+    }
+}
+
+/**
+ * 与闭区间 [lo, hi] 相交的第一个区间（按起点排序），配合 interval_next 遍历所有相交的区间：
+ *   for(n = interval_first(tree, lo, hi); n; n = interval_next(n, lo, hi)) ...
+ */
+TNode* interval_first(const RbTree* tree, int lo, int hi){
+    if(!tree || tree->augment != &interval_augment) return NULL;
+    if(!tree->root || tree->root->aug.interval.max_end < lo) return NULL;
+    return interval_subtree_search(tree->root, lo, hi);
+}
+
+TNode* interval_next(TNode* node, int lo, int hi){
+    TNode *rb = node->right, *prev;
+    while(1){
+        // 先看右子树
+        if(rb && rb->aug.interval.max_end >= lo)
+            return interval_subtree_search(rb, lo, hi);
+
+        // 向上回溯，直到从某个节点的左子树返回
+        do {
+            rb = node->parent;
+            if(!rb) return NULL;
+            prev = node;
+            node = rb;
+            rb = node->right;
+        } while(prev == rb);
+
+        if(hi < node->value) return NULL;
+        if(lo <= node->aug.interval.end) return node;
+    }
 }
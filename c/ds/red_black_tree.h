@@ -0,0 +1,226 @@
+/*
+ * 红黑树对外的类型和接口，实现在 red_black_tree.c
+ */
+#ifndef RED_BLACK_TREE_H
+#define RED_BLACK_TREE_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// 颜色定义
+typedef enum Color{
+    BLACK,
+    RED
+} Color;
+// 节点定义
+typedef struct TNode{
+    struct TNode* left;
+    struct TNode* right;
+    struct TNode* parent;
+    Color color;
+    int value; // 可以采用 void* 来保存任意类型，不过这样的话，
+               // 就需要提供一个 compare 的函数指针了，比较麻烦，
+               // 这里就用 int，目的是理解数据结构本身
+    // 子树的附加信息（augmented data），由树的 RbAugment 负责维护
+    union {
+        size_t size;          // 子树节点个数，用于 rank/select
+        struct {
+            int end;          // 区间 [value, end] 的右端点
+            int max_end;      // 子树中所有区间右端点的最大值
+        } interval;
+    } aug;
+} TNode;
+
+/**
+ * 子树附加信息的维护方式，参考 Linux kernel 的 augmented rbtree
+ * @update 由 node 自身以及左右孩子的附加信息，重新计算 node 的附加信息
+ *
+ * 树结构发生变化的地方（旋转、插入新节点、删除节点）都会调用 update，
+ * 旋转时只需要更新被旋转的两个节点，插入和删除时则沿着父节点一直更新到根
+ */
+typedef struct RbAugment{
+    void (*update)(TNode* node);
+} RbAugment;
+
+/**
+ * 节点分配器，每棵树持有一个，insert 时通过它申请节点，delete_node 时通过它回收节点
+ * @alloc   申请一个节点（未初始化）
+ * @free    回收一个节点
+ * @release 一次性释放分配器持有的所有节点，NULL 表示不支持，destroy_tree 时需要逐个 free
+ * @destroy 销毁分配器本身，NULL 表示分配器不需要销毁（例如静态的 malloc 分配器）
+ * @refs    使用这个分配器的树的个数（new_tree_sharing 加一，destroy_tree 减一），只对 destroy 不为空的分配器计数，
+ *          减到 0 时才整体释放并销毁；共用分配器的树之间可以直接交换节点（tree_join、tree_union 等），但不能在不同线程中同时修改
+ */
+typedef struct NodeAllocator{
+    TNode* (*alloc)(struct NodeAllocator *a);
+    void (*free)(struct NodeAllocator *a, TNode *node);
+    void (*release)(struct NodeAllocator *a);
+    void (*destroy)(struct NodeAllocator *a);
+    int refs;
+} NodeAllocator;
+
+/**
+ * 运行统计：旋转、改色、调整的循环次数、查找比较的节点数，以及调整层数和查找深度的分布
+ * 只有编译时定义了 RB_STATS 才会收集，所有包含本头文件的编译单元需要一致地定义；
+ * 未定义时统计代码全部被预处理掉，没有任何开销，get_stats/reset_stats 返回 -1
+ *
+ * 计数按线程分槽，每个槽对齐到 cache line，线程之间不会争用。线程第一次计数时分到一个编号，退出时归还；
+ * 同时存活的线程超过 RB_STATS_THREADS 个时，多出的线程共享槽位并用原子加，计数可能有少量丢失
+ */
+#ifndef RB_STATS_THREADS
+#define RB_STATS_THREADS 16
+#endif
+#define RB_STATS_DEPTH 64
+
+typedef struct RbStats{
+    unsigned long left_rotations;
+    unsigned long right_rotations;
+    unsigned long recolors;
+    unsigned long insert_fixups;       // insert_adjust 的调用次数（包括递归）
+    unsigned long delete_fixups;       // delete_adjust 的循环次数
+    unsigned long searches;            // search_node 的调用次数
+    unsigned long comparisons;         // search_node 比较过的节点数
+    unsigned long insert_fixup_depth[RB_STATS_DEPTH];  // 每次插入 insert_adjust 的调用层数的分布
+    unsigned long delete_fixup_depth[RB_STATS_DEPTH];  // 每次删除 delete_adjust 的循环次数的分布
+    unsigned long search_depth[RB_STATS_DEPTH];        // 每次查找比较的节点数的分布
+} RbStats;
+
+/**
+ * search_many 同时推进的查找个数，每一轮每个查找向下走一层并预取下一个节点，
+ * 轮到它的下一步时前面 RB_SEARCH_LANES - 1 个查找的访存已经和它的 cache miss 重叠了
+ */
+#ifndef RB_SEARCH_LANES
+#define RB_SEARCH_LANES 32
+#endif
+
+typedef struct RbTree{
+    TNode * root;
+    NodeAllocator * allocator;
+    const RbAugment * augment; // 为空表示不维护附加信息
+    size_t size;               // 节点个数
+    TNode * leftmost;          // 最小的节点，tree_min/tree_pop_min 不需要查找
+    TNode * rightmost;         // 最大的节点，insert_hint 在它之后追加时不需要查找
+    TNode ** pending;          // 宽松模式下还没有修复的连续红色节点，为空表示严格模式
+    size_t pending_count;
+    size_t pending_limit;      // pending 的容量，满了之后每次插入先修复一个
+    struct Relayout * relayout; // relayout_step 进行中的一轮整理，为空表示没有
+#ifdef RB_STATS
+    struct RbStatsSlot * stats; // RB_STATS_THREADS 个按线程划分的计数槽
+#endif
+} RbTree;
+
+typedef enum Order{
+    pre,    // 先序
+    post,   // 后序
+    middle  // 中序
+} Order;
+
+/**
+ * 范围扫描的回调，一次拿到一批 key
+ * @return 非 0 表示停止扫描
+ */
+typedef int (*ScanCallback)(const int* keys, size_t n, void* ctx);
+
+/**
+ * relayout 搬动节点时的回调，from 只用来标识原来的节点，回调返回后就被回收，不能再访问
+ * 调用方持有的节点指针需要在这里换成 to
+ */
+typedef void (*MovedCallback)(const TNode* from, TNode* to, void* ctx);
+
+// relayout 之后节点在内存中的排列顺序
+typedef enum RelayoutOrder{
+    RELAYOUT_BFS,   // 按层，上面几层集中在一起
+    RELAYOUT_VEB    // van Emde Boas：按高度对半切分，上半部分和下面的每棵子树各自连续存放，递归进行
+} RelayoutOrder;
+
+// 批量操作
+typedef enum BatchOpType{
+    BATCH_INSERT,
+    BATCH_DELETE
+} BatchOpType;
+
+typedef struct BatchOp{
+    int value;
+    BatchOpType type;
+} BatchOp;
+
+// 分配器
+extern NodeAllocator malloc_allocator;
+NodeAllocator* new_slab_allocator(size_t slab_nodes);
+TNode* slab_reserve(NodeAllocator *a, size_t n);
+
+// 树的创建与销毁
+RbTree* new_tree();
+RbTree* new_tree_with_allocator(NodeAllocator* allocator);
+RbTree* new_tree_sharing(const RbTree* tree);
+RbTree* build_from_sorted(const int* keys, int n);
+void destroy_tree(RbTree* tree);
+TNode* alloc_node(RbTree* tree, int value);
+void free_node(RbTree* tree, TNode* node);
+
+// 基本操作
+int insert(RbTree *tree, int value);
+int insert_node(RbTree *tree, TNode *node);
+TNode* find_or_insert(RbTree *tree, int value, int *inserted);
+TNode* insert_hint(RbTree *tree, TNode *hint, int value);
+int delete_node(RbTree * tree, int value);
+void erase_node(RbTree * tree, TNode * delNode);
+void attach_node(RbTree *tree, TNode *parent, TNode *node);
+int apply_batch(RbTree* tree, BatchOp* ops, size_t n, size_t* done, size_t* applied);
+int set_relaxed(RbTree* tree, size_t limit);
+size_t rebalance_step(RbTree* tree, size_t budget);
+void rebalance_all(RbTree* tree);
+TNode * search_node(RbTree * tree, int value);
+size_t search_many(RbTree * tree, const int* keys, size_t n, TNode** out);
+TNode* tree_min(const RbTree* tree);
+TNode* tree_max(const RbTree* tree);
+int tree_pop_min(RbTree* tree, int* value);
+int tree_pop_max(RbTree* tree, int* value);
+int tree_height(const RbTree* tree);
+void visit_tree(const RbTree * tree, Order order);
+
+// 旋转与调整
+void left_rotate(RbTree *tree, TNode* node);
+void right_rotate(RbTree *tree, TNode* node);
+void insert_adjust(RbTree *tree, TNode *node);
+void delete_adjust(RbTree * tree, TNode* parentNode, TNode* childNode);
+
+// 有序遍历
+TNode* first_node(const RbTree* tree);
+TNode* last_node(const RbTree* tree);
+TNode* next_node(const TNode* n);
+TNode* prev_node(const TNode* n);
+TNode* lower_bound(const RbTree* tree, int value);
+TNode* upper_bound(const RbTree* tree, int value);
+size_t range_scan(const RbTree* tree, int lo, int hi, int* buf, size_t batch, ScanCallback callback, void* ctx);
+
+// 内存重排
+int relayout(RbTree* tree, RelayoutOrder order, MovedCallback moved, void* ctx);
+size_t relayout_step(RbTree* tree, size_t budget, MovedCallback moved, void* ctx);
+void relayout_cancel(RbTree* tree);
+
+// 运行统计
+int get_stats(const RbTree* tree, RbStats* out);
+int reset_stats(RbTree* tree);
+
+// 子树附加信息
+extern const RbAugment size_augment;
+extern const RbAugment interval_augment;
+void set_augment(RbTree* tree, const RbAugment* augment);
+void augment_propagate(RbTree *tree, TNode *node);
+size_t subtree_size(const TNode* n);
+size_t tree_rank(const RbTree* tree, int value);
+TNode* tree_select(const RbTree* tree, size_t k);
+int insert_interval(RbTree* tree, int start, int end);
+int upsert_interval(RbTree* tree, int start, int end);
+TNode* interval_first(const RbTree* tree, int lo, int hi);
+TNode* interval_next(TNode* node, int lo, int hi);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
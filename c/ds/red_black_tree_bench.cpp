@@ -0,0 +1,1356 @@
+/*
+ * 红黑树的性能测试
+ *
+ * 编译：
+ *   gcc -O2 -c red_black_tree.c red_black_tree_persistent.c red_black_tree_compact.c red_black_tree_frozen.c \
+ *       red_black_tree_mapped.c red_black_tree_topdown.c red_black_tree_sharded.c red_black_tree_join.c red_black_tree_dump.c \
+ *       red_black_tree_latch.c
+ *   g++ -O2 -pthread -o rb_bench red_black_tree_bench.cpp *.o
+ *
+ * 用法：
+ *   ./rb_bench [-w seq,random,zipf,mixed] [-n 1000,1000000] [-o ops] [-i rb,slab,ptree,cptr,cidx,td,map] [-r read%] [-s seed]
+ *   ./rb_bench build [-n ...]        有序快照重建：逐个 insert 与 build_from_sorted 对比
+ *   ./rb_bench hint [-n ...] [-o ops]   升序追加：insert 与 insert_hint 对比；查找或插入：search_node + insert 与 find_or_insert 对比
+ *   ./rb_bench relaxed [-n ...] [-o ops] 写入突发：严格模式与不同 limit 的宽松模式的插入延迟、未修复时的查找代价、rebalance_all 耗时
+ *   ./rb_bench timer [-n ...] [-o ops]  定时器队列（hold 模型）：二叉堆与红黑树的取最早到期 + 重新插入，树分别从根找最小和读缓存的最小节点
+ *   ./rb_bench batch [-n ...] [-o ops]  apply_batch 与逐个 insert/delete_node 对比，批大小 1K~1M
+ *   ./rb_bench frozen [-n ...] [-o ops] search_node 与 freeze 之后的 frozen_search / 批量 lower_bound 对比
+ *   ./rb_bench mapped [-n ...] [-o ops] 逐个 insert 重建与 save_tree + open_mapped 对比，以及冷、热查找
+ *   ./rb_bench setops [-n ...] [-t 1,2,4,...] 集合运算与范围删除：逐个 insert/delete_node 与 join/split 实现对比
+ *   ./rb_bench sharded [-n ...] [-o ops] [-t 1,2,4,...] 多线程均匀随机插入/删除，一把全局锁的 RbTree 与分片树对比
+ *   ./rb_bench latch [-n ...] [-o ops] [-t 1,2,4,...]   一个写线程持续插入/删除时多个读线程的查找吞吐，读写锁 + search_node 与 latch tree 对比
+ *   ./rb_bench dump [-n ...]         导出整棵树到 /dev/null：visit_tree 的 printf 与 dump_tree 的文本、二进制、Graphviz 对比
+ *   ./rb_bench relayout [-n ...] [-o ops] 随机插入/删除打散之后，relayout（BFS、vEB）和 relayout_step 前后的查找、有序遍历耗时
+ *   ./rb_bench many [-n ...] [-o ops]   逐个 search_node 与每批 32/64/256 个 key 的 search_many 对比
+ *
+ * 每个 (实现, 负载, 规模) 依次运行以下阶段：
+ *   insert   按负载顺序插入 n 个 key（seq 为升序，其余为随机顺序）
+ *   run      ops 次操作：seq/random/zipf 为对应分布的查找，mixed 为按比例混合的查找/插入/删除
+ *   delete   删除一半的 key
+ *   destroy  释放整棵树（这一行的 ns/op 为总耗时）
+ * 输出 ns/op、采样的 p50/p99 延迟、树高、每次操作的旋转次数、RSS，
+ * 以及 perf_event_open 可用时的 cache miss / branch miss。
+ * 对照组 map 为 std::set<int>（同样是红黑树实现），ptree 为可持久化（path copying）红黑树，
+ * cptr/cidx 为紧凑布局（颜色压缩进 parent 指针 / 32 位下标），td 为没有 parent 指针、一遍向下完成调整的 top-down 红黑树。
+ * insert 阶段之后额外输出一行每个 key 占用的堆内存字节数（glibc mallinfo2 统计的使用量增量）。
+ * rb/slab 的旋转次数以及改色、调整层数、查找深度等统计需要所有文件都加上 -DRB_STATS 编译，否则 rot/op 输出 n/a；map 拿不到旋转次数，总是 n/a。
+ */
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <queue>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <linux/perf_event.h>
+#include <fcntl.h>
+#include <malloc.h>
+#include <sys/mman.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "red_black_tree.h"
+#include "red_black_tree_persistent.h"
+#include "red_black_tree_compact.h"
+#include "red_black_tree_frozen.h"
+#include "red_black_tree_mapped.h"
+#include "red_black_tree_topdown.h"
+#include "red_black_tree_sharded.h"
+#include "red_black_tree_join.h"
+#include "red_black_tree_dump.h"
+#include "red_black_tree_latch.h"
+
+typedef std::chrono::steady_clock Clock;
+
+static double now_sec(){
+    return std::chrono::duration<double>(Clock::now().time_since_epoch()).count();
+}
+
+// xorshift64，保证每次运行结果可复现
+struct Rng{
+    uint64_t s;
+    explicit Rng(uint64_t seed) : s(seed ? seed : 88172645463325252ULL) {}
+    uint64_t next(){
+        s ^= s << 13;
+        s ^= s >> 7;
+        s ^= s << 17;
+        return s;
+    }
+    double uniform(){ return (next() >> 11) * (1.0 / 9007199254740992.0); }
+};
+
+static void shuffle_keys(std::vector<int>& keys, uint64_t seed){
+    Rng rng(seed);
+    for(size_t i = keys.size(); i > 1; --i){
+        size_t j = rng.next() % i;
+        std::swap(keys[i - 1], keys[j]);
+    }
+}
+
+/**
+ * Zipf 分布（theta = 0.99），Gray 等人的 "Quickly Generating Billion-Record Synthetic Databases"，
+ * 与 YCSB 相同，初始化 O(n)，每次取样 O(1)，返回 [0, n) 中的排名
+ */
+struct Zipf{
+    double theta, zetan, alpha, eta, half_pow;
+    uint64_t n;
+    Zipf(uint64_t n_, double theta_ = 0.99) : theta(theta_), n(n_) {
+        zetan = 0;
+        for(uint64_t i = 1; i <= n; ++i) zetan += 1.0 / std::pow((double) i, theta);
+        double zeta2 = 1.0 + 1.0 / std::pow(2.0, theta);
+        alpha = 1.0 / (1.0 - theta);
+        eta = (1.0 - std::pow(2.0 / n, 1.0 - theta)) / (1.0 - zeta2 / zetan);
+        half_pow = 1.0 + std::pow(0.5, theta);
+    }
+    uint64_t next(Rng& rng){
+        double u = rng.uniform();
+        double uz = u * zetan;
+        if(uz < 1.0) return 0;
+        if(uz < half_pow) return 1;
+        uint64_t r = (uint64_t)(n * std::pow(eta * u - eta + 1.0, alpha));
+        return r < n ? r : n - 1;
+    }
+};
+
+// ------------------------- 硬件计数器 -------------------------
+struct PerfCounters{
+    int fds[2];
+    bool ok;
+    PerfCounters() : ok(false) {
+        fds[0] = open_counter(PERF_COUNT_HW_CACHE_MISSES);
+        fds[1] = open_counter(PERF_COUNT_HW_BRANCH_MISSES);
+        ok = fds[0] >= 0 && fds[1] >= 0;
+    }
+    ~PerfCounters(){
+        for(int i = 0; i < 2; ++i) if(fds[i] >= 0) close(fds[i]);
+    }
+    static int open_counter(uint64_t config){
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.size = sizeof(attr);
+        attr.config = config;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        return (int) syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+    }
+    void start(){
+        if(!ok) return;
+        for(int i = 0; i < 2; ++i){
+            ioctl(fds[i], PERF_EVENT_IOC_RESET, 0);
+            ioctl(fds[i], PERF_EVENT_IOC_ENABLE, 0);
+        }
+    }
+    void stop(uint64_t* out){
+        for(int i = 0; i < 2; ++i){
+            out[i] = 0;
+            if(!ok) continue;
+            ioctl(fds[i], PERF_EVENT_IOC_DISABLE, 0);
+            if(read(fds[i], &out[i], sizeof(out[i])) != sizeof(out[i])) out[i] = 0;
+        }
+    }
+};
+
+static double rss_mb(){
+    long pages = 0, resident = 0;
+    FILE* f = fopen("/proc/self/statm", "r");
+    if(!f) return 0;
+    if(fscanf(f, "%ld %ld", &pages, &resident) != 2) resident = 0;
+    fclose(f);
+    return resident * (double) sysconf(_SC_PAGESIZE) / (1024.0 * 1024.0);
+}
+
+// 当前进程已使用的堆内存（包括 mmap 出来的大块）
+static double heap_in_use(){
+    struct mallinfo2 mi = mallinfo2();
+    return (double) mi.uordblks + (double) mi.hblkhd;
+}
+
+// ------------------------- 被测实现 -------------------------
+// rotations() 的返回值，表示这个实现没有统计旋转次数，rot/op 一列输出 n/a
+static const unsigned long NO_ROTATIONS = (unsigned long) -1;
+
+struct RbImpl{
+    RbTree* tree;
+    explicit RbImpl(bool slab) {
+        tree = slab ? new_tree_with_allocator(new_slab_allocator(4096)) : new_tree();
+    }
+    ~RbImpl(){ if(tree) destroy_tree(tree); }
+    bool insert(int k){ return ::insert(tree, k) == 1; }
+    bool find(int k){ return search_node(tree, k) != NULL; }
+    bool erase(int k){ return delete_node(tree, k) == 1; }
+    void destroy(){ destroy_tree(tree); tree = NULL; }
+    int height() const { return tree_height(tree); }
+    // 旋转次数来自 RB_STATS 的计数，没有以 -DRB_STATS 编译时 get_stats 返回 -1
+    unsigned long rotations() const {
+        RbStats st;
+        if(get_stats(tree, &st) != 0) return NO_ROTATIONS;
+        return st.left_rotations + st.right_rotations;
+    }
+};
+
+struct PTreeImpl{
+    PRbTree* tree;
+    PTreeImpl() : tree(new_ptree()) {}
+    ~PTreeImpl(){ if(tree) destroy_ptree(tree); }
+    bool insert(int k){ return pinsert(tree, k) == 1; }
+    bool find(int k){ return psearch(tree->root, k) != NULL; }
+    bool erase(int k){ return pdelete(tree, k) == 1; }
+    void destroy(){ destroy_ptree(tree); tree = NULL; }
+    int height() const { return -1; }
+    unsigned long rotations() const { return tree->rotations; }
+};
+
+struct CPtrImpl{
+    CPtrTree* tree;
+    CPtrImpl() : tree(new_cptr_tree()) {}
+    ~CPtrImpl(){ if(tree) destroy_cptr_tree(tree); }
+    bool insert(int k){ return cptr_insert(tree, k) == 1; }
+    bool find(int k){ return cptr_contains(tree, k) != 0; }
+    bool erase(int k){ return cptr_delete(tree, k) == 1; }
+    void destroy(){ destroy_cptr_tree(tree); tree = NULL; }
+    int height() const { return -1; }
+    unsigned long rotations() const { return tree->rotations; }
+};
+
+struct CIdxImpl{
+    CIdxTree* tree;
+    CIdxImpl() : tree(new_cidx_tree()) {}
+    ~CIdxImpl(){ if(tree) destroy_cidx_tree(tree); }
+    bool insert(int k){ return cidx_insert(tree, k) == 1; }
+    bool find(int k){ return cidx_contains(tree, k) != 0; }
+    bool erase(int k){ return cidx_delete(tree, k) == 1; }
+    void destroy(){ destroy_cidx_tree(tree); tree = NULL; }
+    int height() const { return -1; }
+    unsigned long rotations() const { return tree->rotations; }
+};
+
+struct TDImpl{
+    TDTree* tree;
+    TDImpl() : tree(new_td_tree()) {}
+    ~TDImpl(){ if(tree) destroy_td_tree(tree); }
+    bool insert(int k){ return td_insert(tree, k) == 1; }
+    bool find(int k){ return td_search(tree, k) != NULL; }
+    bool erase(int k){ return td_delete(tree, k) == 1; }
+    void destroy(){ destroy_td_tree(tree); tree = NULL; }
+    int height() const { return -1; }
+    unsigned long rotations() const { return tree->rotations; }
+};
+
+struct MapImpl{
+    std::set<int>* set;
+    MapImpl() : set(new std::set<int>()) {}
+    ~MapImpl(){ delete set; }
+    bool insert(int k){ return set->insert(k).second; }
+    bool find(int k){ return set->find(k) != set->end(); }
+    bool erase(int k){ return set->erase(k) == 1; }
+    void destroy(){ delete set; set = NULL; }
+    int height() const { return -1; }
+    unsigned long rotations() const { return NO_ROTATIONS; }   // std::set 不暴露旋转次数
+};
+
+// ------------------------- 负载 -------------------------
+struct Options{
+    std::vector<std::string> workloads;
+    std::vector<std::string> impls;
+    std::vector<long> sizes;
+    std::vector<long> threads;
+    long ops;
+    int read_pct;
+    uint64_t seed;
+    Options() : ops(1000000), read_pct(90), seed(2463534242ULL) {
+        workloads = { "seq", "random", "zipf", "mixed" };
+        impls = { "rb", "slab", "map" };
+        sizes = { 1000, 10000, 100000, 1000000 };
+        long hw = (long) std::thread::hardware_concurrency();
+        for(long t = 1; t < hw; t *= 2) threads.push_back(t);
+        threads.push_back(hw > 0 ? hw : 1);
+    }
+};
+
+// 每隔 SAMPLE_MASK+1 次操作采样一次单次延迟（包含计时本身约几十 ns 的开销）
+static const long SAMPLE_MASK = 15;
+
+struct Phase{
+    const char* name;
+    long ops;
+    double sec;
+    std::vector<double> lat;   // 采样的单次延迟，ns
+    uint64_t perf[2];
+    unsigned long rotations;   // NO_ROTATIONS 表示没有统计
+};
+
+static double percentile(std::vector<double>& v, double p){
+    if(v.empty()) return 0;
+    size_t idx = (size_t)(p * (v.size() - 1));
+    std::nth_element(v.begin(), v.begin() + idx, v.end());
+    return v[idx];
+}
+
+static void report(const char* impl, const char* workload, long n, Phase& ph, int height, bool perf_ok){
+    char perf[64] = "      n/a       n/a";
+    char rot[16] = "    n/a";
+    if(perf_ok && ph.ops)
+        snprintf(perf, sizeof(perf), "%9.2f %9.2f", (double) ph.perf[0] / ph.ops, (double) ph.perf[1] / ph.ops);
+    if(ph.ops && ph.rotations != NO_ROTATIONS)
+        snprintf(rot, sizeof(rot), "%7.3f", (double) ph.rotations / ph.ops);
+    double p50 = percentile(ph.lat, 0.50), p99 = percentile(ph.lat, 0.99);
+    printf("%-5s %-7s %10ld %-8s %10ld %9.1f %8.0f %8.0f %6d %s %9.1f %s\n",
+        impl, workload, n, ph.name, ph.ops, ph.ops ? ph.sec * 1e9 / ph.ops : ph.sec * 1e9,
+        p50, p99, height, rot, rss_mb(), perf);
+    fflush(stdout);
+}
+
+// 分布中 p 分位所在的桶
+static int hist_percentile(const unsigned long* hist, double p){
+    unsigned long total = 0, acc = 0;
+    for(int i = 0; i < RB_STATS_DEPTH; ++i) total += hist[i];
+    for(int i = 0; i < RB_STATS_DEPTH; ++i){
+        acc += hist[i];
+        if(total && acc >= p * total) return i;
+    }
+    return 0;
+}
+
+/**
+ * 以 -DRB_STATS 编译时，在每个阶段之后输出 RbTree 的统计：每次操作的改色次数、
+ * 插入/删除调整的平均和 p99 层数、查找的平均和 p99 比较次数，输出后清零
+ */
+template<typename Impl>
+static void report_stats(const char*, const char*, Phase&, Impl&){}
+
+static void report_stats(const char* impl, const char* workload, Phase& ph, RbImpl& rb){
+    RbStats st;
+    if(!rb.tree || get_stats(rb.tree, &st) != 0 || !ph.ops) return;
+    unsigned long inserts = 0, deletes = 0;
+    for(int i = 0; i < RB_STATS_DEPTH; ++i){
+        inserts += st.insert_fixup_depth[i];
+        deletes += st.delete_fixup_depth[i];
+    }
+    printf("# %s %s %s recolor/op=%.3f ins-fix=%.2f(p99 %d) del-fix=%.2f(p99 %d) cmp/search=%.2f(p99 %d)\n",
+        impl, workload, ph.name, (double) st.recolors / ph.ops,
+        inserts ? (double) st.insert_fixups / inserts : 0.0, hist_percentile(st.insert_fixup_depth, 0.99),
+        deletes ? (double) st.delete_fixups / deletes : 0.0, hist_percentile(st.delete_fixup_depth, 0.99),
+        st.searches ? (double) st.comparisons / st.searches : 0.0, hist_percentile(st.search_depth, 0.99));
+    reset_stats(rb.tree);
+}
+
+/**
+ * 对 ops 个操作计时，op(i) 执行第 i 个操作
+ */
+template<typename Impl, typename Op>
+static void run_phase(Phase& ph, Impl& impl, PerfCounters& pc, long ops, Op op){
+    ph.ops = ops;
+    ph.lat.clear();
+    ph.lat.reserve(ops / (SAMPLE_MASK + 1) + 1);
+    unsigned long r0 = impl.rotations();
+    pc.start();
+    double t0 = now_sec();
+    for(long i = 0; i < ops; ++i){
+        if((i & SAMPLE_MASK) == 0){
+            Clock::time_point s = Clock::now();
+            op(i);
+            ph.lat.push_back(std::chrono::duration<double, std::nano>(Clock::now() - s).count());
+        } else {
+            op(i);
+        }
+    }
+    ph.sec = now_sec() - t0;
+    pc.stop(ph.perf);
+    ph.rotations = r0 == NO_ROTATIONS ? NO_ROTATIONS : impl.rotations() - r0;
+}
+
+static volatile long sink;
+
+template<typename Impl>
+static void run_workload(const char* impl_name, Impl& impl, const std::string& workload, long n, const Options& opt, PerfCounters& pc){
+    std::vector<int> keys(n);
+    for(long i = 0; i < n; ++i) keys[i] = (int)(i * 2);   // 偶数 key，奇数可以用作未命中的查找
+    if(workload != "seq") shuffle_keys(keys, opt.seed);
+
+    Rng rng(opt.seed ^ 0x9e3779b97f4a7c15ULL);
+    Phase ph;
+    long found = 0;
+
+    ph.name = "insert";
+    double heap0 = heap_in_use();
+    run_phase(ph, impl, pc, n, [&](long i){ impl.insert(keys[i]); });
+    int height = impl.height();
+    report(impl_name, workload.c_str(), n, ph, height, pc.ok);
+    report_stats(impl_name, workload.c_str(), ph, impl);
+    printf("# %s %s n=%ld bytes/key=%.1f\n", impl_name, workload.c_str(), n, (heap_in_use() - heap0) / n);
+
+    ph.name = "run";
+    if(workload == "seq"){
+        run_phase(ph, impl, pc, opt.ops, [&](long i){ found += impl.find(keys[i % n]); });
+    } else if(workload == "random"){
+        run_phase(ph, impl, pc, opt.ops, [&](long){ found += impl.find(keys[rng.next() % n]); });
+    } else if(workload == "zipf"){
+        Zipf zipf(n);
+        run_phase(ph, impl, pc, opt.ops, [&](long){ found += impl.find(keys[zipf.next(rng)]); });
+    } else {
+        // 查找命中已有 key，插入/删除在 [0, 2n) 上均匀分布，树的规模基本保持不变
+        run_phase(ph, impl, pc, opt.ops, [&](long){
+            uint64_t r = rng.next();
+            int pct = (int)(r % 100);
+            int k = (int)((r >> 8) % (uint64_t)(2 * n));
+            if(pct < opt.read_pct) found += impl.find(keys[(r >> 8) % n]);
+            else if(pct < opt.read_pct + (100 - opt.read_pct) / 2) impl.insert(k);
+            else impl.erase(k);
+        });
+    }
+    height = impl.height();
+    report(impl_name, workload.c_str(), n, ph, height, pc.ok);
+    report_stats(impl_name, workload.c_str(), ph, impl);
+
+    ph.name = "delete";
+    run_phase(ph, impl, pc, n / 2, [&](long i){ impl.erase(keys[i]); });
+    height = impl.height();
+    report(impl_name, workload.c_str(), n, ph, height, pc.ok);
+    report_stats(impl_name, workload.c_str(), ph, impl);
+
+    ph.name = "destroy";
+    ph.ops = 0;
+    ph.lat.clear();
+    ph.rotations = 0;
+    pc.start();
+    double t0 = now_sec();
+    impl.destroy();
+    ph.sec = now_sec() - t0;
+    pc.stop(ph.perf);
+    report(impl_name, workload.c_str(), n, ph, 0, false);
+
+    sink = found;
+}
+
+// ------------------------- 批量建树 -------------------------
+static void bench_build(const Options& opt){
+    printf("%10s %14s %20s\n", "n", "insert(ms)", "build_from_sorted(ms)");
+    for(size_t s = 0; s < opt.sizes.size(); ++s){
+        long n = opt.sizes[s];
+        std::vector<int> sorted(n);
+        for(long i = 0; i < n; ++i) sorted[i] = (int) i;
+
+        double t0 = now_sec();
+        RbTree* tree = new_tree_with_allocator(new_slab_allocator(4096));
+        for(long i = 0; i < n; ++i) insert(tree, sorted[i]);
+        double t1 = now_sec();
+        RbTree* built = build_from_sorted(sorted.data(), (int) n);
+        double t2 = now_sec();
+
+        printf("%10ld %14.2f %20.2f\n", n, (t1 - t0) * 1e3, (t2 - t1) * 1e3);
+        destroy_tree(tree);
+        destroy_tree(built);
+    }
+}
+
+// ------------------------- 位置提示插入 -------------------------
+/**
+ * 定时器队列的 hold 模型：队列中保持 n 个定时器，每次操作取出最早到期的一个，再以它的到期时间加上 [1, 32n] 中的随机延迟重新插入。
+ * 二叉堆为 std::priority_queue；树中的 key 不能重复，到期时间冲突时顺延 1（时间轴上只有 1/32 被占用，冲突很少）。
+ * walk 每次从根向下找最小节点再 erase_node（没有缓存时的做法），cached 为 tree_pop_min，
+ * 另外给出只查看最早到期时间（first_node 与 tree_min）的开销
+ */
+static void bench_timer(const Options& opt){
+    printf("%10s %12s %14s %14s %12s %12s\n", "n", "heap(ns/op)", "tree-walk(ns)", "tree-cache(ns)", "peek-walk", "peek-cache");
+    for(size_t s = 0; s < opt.sizes.size(); ++s){
+        long n = opt.sizes[s];
+        uint64_t span = 32 * (uint64_t) n;
+        std::vector<int> init(n);
+        Rng rng(opt.seed);
+        for(long i = 0; i < n; ++i) init[i] = (int)(rng.next() % span);
+
+        std::priority_queue<int, std::vector<int>, std::greater<int> > heap(init.begin(), init.end());
+        Rng r0(opt.seed + 1);
+        double t0 = now_sec();
+        for(long i = 0; i < opt.ops; ++i){
+            int due = heap.top();
+            heap.pop();
+            heap.push(due + 1 + (int)(r0.next() % span));
+        }
+        double t1 = now_sec();
+
+        double elapsed[2];
+        for(int cached = 0; cached < 2; ++cached){
+            RbTree* t = new_tree_with_allocator(new_slab_allocator(4096));
+            for(long i = 0; i < n; ++i) insert(t, init[i]);
+            Rng r1(opt.seed + 1);
+            double t2 = now_sec();
+            for(long i = 0; i < opt.ops; ++i){
+                int due;
+                if(cached){
+                    tree_pop_min(t, &due);
+                } else {
+                    TNode* first = first_node(t);
+                    due = first->value;
+                    erase_node(t, first);
+                }
+                int next = due + 1 + (int)(r1.next() % span), inserted = 0;
+                while(find_or_insert(t, next, &inserted) && !inserted) ++next;
+            }
+            elapsed[cached] = now_sec() - t2;
+            destroy_tree(t);
+        }
+
+        RbTree* t = new_tree_with_allocator(new_slab_allocator(4096));
+        for(long i = 0; i < n; ++i) insert(t, init[i]);
+        long sink = 0;
+        double t3 = now_sec();
+        for(long i = 0; i < opt.ops; ++i) sink += first_node(t)->value;
+        double t4 = now_sec();
+        for(long i = 0; i < opt.ops; ++i) sink += tree_min(t)->value;
+        double t5 = now_sec();
+        destroy_tree(t);
+        if(sink == 42) printf("#\n");
+
+        printf("%10ld %12.1f %14.1f %14.1f %12.2f %12.2f\n", n, (t1 - t0) * 1e9 / opt.ops, elapsed[0] * 1e9 / opt.ops,
+            elapsed[1] * 1e9 / opt.ops, (t4 - t3) * 1e9 / opt.ops, (t5 - t4) * 1e9 / opt.ops);
+    }
+}
+
+/**
+ * append：空树中按升序插入 n 个 key（时间序列），insert 每次从根查找，insert_hint 以上一次返回的节点为提示；
+ * upsert：树中预先有 n 个偶数 key，随机的 [0, 2n) 中的 key 一半已存在，
+ * 先 search_node 不存在再 insert（查找两遍）与 find_or_insert（查找一遍）对比
+ */
+static void bench_hint(const Options& opt){
+    printf("%10s %16s %16s %16s %20s\n", "n", "insert(ns/key)", "hint(ns/key)", "search+insert(ns)", "find_or_insert(ns)");
+    for(size_t s = 0; s < opt.sizes.size(); ++s){
+        long n = opt.sizes[s];
+
+        RbTree* plain = new_tree_with_allocator(new_slab_allocator(4096));
+        double t0 = now_sec();
+        for(long i = 0; i < n; ++i) insert(plain, (int) i);
+        double t1 = now_sec();
+        RbTree* hinted = new_tree_with_allocator(new_slab_allocator(4096));
+        TNode* hint = NULL;
+        double t2 = now_sec();
+        for(long i = 0; i < n; ++i) hint = insert_hint(hinted, hint, (int) i);
+        double t3 = now_sec();
+        destroy_tree(plain);
+        destroy_tree(hinted);
+
+        std::vector<int> sorted(n);
+        for(long i = 0; i < n; ++i) sorted[i] = (int)(i * 2);
+        std::vector<int> keys(opt.ops);
+        Rng rng(opt.seed);
+        for(long i = 0; i < opt.ops; ++i) keys[i] = (int)(rng.next() % (uint64_t)(2 * n));
+        RbTree* twice = build_from_sorted(sorted.data(), (int) n);
+        RbTree* once = build_from_sorted(sorted.data(), (int) n);
+        double t4 = now_sec();
+        for(long i = 0; i < opt.ops; ++i){
+            if(!search_node(twice, keys[i])) insert(twice, keys[i]);
+        }
+        double t5 = now_sec();
+        int inserted;
+        for(long i = 0; i < opt.ops; ++i) find_or_insert(once, keys[i], &inserted);
+        double t6 = now_sec();
+        destroy_tree(twice);
+        destroy_tree(once);
+
+        printf("%10ld %16.1f %16.1f %16.1f %20.1f\n", n, (t1 - t0) * 1e9 / n, (t3 - t2) * 1e9 / n,
+            (t5 - t4) * 1e9 / opt.ops, (t6 - t5) * 1e9 / opt.ops);
+    }
+}
+
+// ------------------------- 宽松平衡 -------------------------
+/**
+ * 树中预先有 n 个偶数 key，突发插入 ops 个 [0, 2n) 中的随机 key，逐个计时得到 p50/p99，
+ * 然后在冲突还没有修复时随机查找 ops 次，再用 rebalance_all 修复全部冲突，最后再查找一遍；
+ * limit 为 0 表示严格模式
+ */
+static void bench_relaxed(const Options& opt){
+    const long limits[] = { 0, 1024, 65536, opt.ops };
+    printf("%10s %8s %10s %8s %8s %9s %7s %12s %10s %12s\n", "n", "limit", "ins(ns/op)", "p50", "p99",
+        "pending", "height", "search(ns)", "drain(ms)", "after(ns)");
+    for(size_t s = 0; s < opt.sizes.size(); ++s){
+        long n = opt.sizes[s];
+        std::vector<int> sorted(n);
+        for(long i = 0; i < n; ++i) sorted[i] = (int)(i * 2);
+        std::vector<int> keys(opt.ops), probes(opt.ops);
+        Rng rng(opt.seed);
+        for(long i = 0; i < opt.ops; ++i){
+            keys[i] = (int)(rng.next() % (uint64_t)(2 * n));
+            probes[i] = (int)(rng.next() % (uint64_t)(2 * n));
+        }
+
+        for(size_t l = 0; l < sizeof(limits) / sizeof(limits[0]); ++l){
+            RbTree* tree = build_from_sorted(sorted.data(), (int) n);
+            if(limits[l]) set_relaxed(tree, limits[l]);
+            std::vector<double> lat(opt.ops);
+            double t0 = now_sec();
+            for(long i = 0; i < opt.ops; ++i){
+                double a = now_sec();
+                insert(tree, keys[i]);
+                lat[i] = (now_sec() - a) * 1e9;
+            }
+            double t1 = now_sec();
+            size_t pending = tree->pending_count;
+            int height = tree_height(tree);
+
+            long found = 0;
+            double t2 = now_sec();
+            for(long i = 0; i < opt.ops; ++i) found += search_node(tree, probes[i]) != NULL;
+            double t3 = now_sec();
+            rebalance_all(tree);
+            double t4 = now_sec();
+            for(long i = 0; i < opt.ops; ++i) found += search_node(tree, probes[i]) != NULL;
+            double t5 = now_sec();
+            sink += found;
+
+            printf("%10ld %8ld %10.1f %8.0f %8.0f %9zu %7d %12.1f %10.2f %12.1f\n", n, limits[l],
+                (t1 - t0) * 1e9 / opt.ops, percentile(lat, 0.50), percentile(lat, 0.99), pending, height,
+                (t3 - t2) * 1e9 / opt.ops, (t4 - t3) * 1e3, (t5 - t4) * 1e9 / opt.ops);
+            destroy_tree(tree);
+        }
+    }
+}
+
+// ------------------------- 批量修改 -------------------------
+/**
+ * 树中预先有 n 个偶数 key，每批为随机的插入（奇数 key）和删除（偶数 key）各一半，
+ * 分别用 apply_batch 和逐个 insert/delete_node 执行同样的批次，比较每个 key 的耗时
+ */
+static void bench_batch(const Options& opt){
+    static const long batch_sizes[] = { 1000, 10000, 100000, 1000000 };
+    printf("%10s %10s %14s %14s\n", "n", "batch", "single(ns/key)", "batch(ns/key)");
+    for(size_t s = 0; s < opt.sizes.size(); ++s){
+        long n = opt.sizes[s];
+        std::vector<int> sorted(n);
+        for(long i = 0; i < n; ++i) sorted[i] = (int)(i * 2);
+
+        for(size_t b = 0; b < sizeof(batch_sizes) / sizeof(batch_sizes[0]); ++b){
+            long bs = batch_sizes[b];
+            long rounds = std::max(1L, opt.ops / bs);
+            Rng rng(opt.seed);
+            std::vector<BatchOp> ops(bs);
+
+            RbTree* single = build_from_sorted(sorted.data(), (int) n);
+            RbTree* batched = build_from_sorted(sorted.data(), (int) n);
+            double single_sec = 0, batch_sec = 0;
+            for(long r = 0; r < rounds; ++r){
+                for(long i = 0; i < bs; ++i){
+                    uint64_t x = rng.next();
+                    int k = (int)((x >> 1) % (uint64_t) n) * 2;
+                    ops[i].type = (x & 1) ? BATCH_INSERT : BATCH_DELETE;
+                    ops[i].value = (x & 1) ? k + 1 : k;
+                }
+
+                double t0 = now_sec();
+                for(long i = 0; i < bs; ++i){
+                    if(ops[i].type == BATCH_INSERT) insert(single, ops[i].value);
+                    else delete_node(single, ops[i].value);
+                }
+                double t1 = now_sec();
+                apply_batch(batched, ops.data(), ops.size(), NULL, NULL);
+                double t2 = now_sec();
+                single_sec += t1 - t0;
+                batch_sec += t2 - t1;
+            }
+            printf("%10ld %10ld %14.1f %14.1f\n", n, bs,
+                single_sec * 1e9 / (rounds * bs), batch_sec * 1e9 / (rounds * bs));
+            destroy_tree(single);
+            destroy_tree(batched);
+        }
+    }
+}
+
+// ------------------------- 冻结快照 -------------------------
+/**
+ * 树中为 n 个偶数 key，随机查找 [0, 2n) 中的 key（一半命中），
+ * 比较 search_node、frozen_search 以及按 1024 个一批的 frozen_lower_bound_many
+ */
+static void bench_frozen(const Options& opt){
+    static const long group = 1024;
+    printf("%10s %12s %14s %14s %14s  (avx2: %s)\n", "n", "freeze(ms)", "search_node", "frozen_search",
+        "frozen_many", __builtin_cpu_supports("avx2") ? "yes" : "no");
+    for(size_t s = 0; s < opt.sizes.size(); ++s){
+        long n = opt.sizes[s];
+        std::vector<int> sorted(n);
+        for(long i = 0; i < n; ++i) sorted[i] = (int)(i * 2);
+        RbTree* tree = build_from_sorted(sorted.data(), (int) n);
+
+        double t0 = now_sec();
+        FrozenTree* ft = freeze(tree);
+        double t1 = now_sec();
+
+        Rng rng(opt.seed);
+        std::vector<int> keys(opt.ops);
+        for(long i = 0; i < opt.ops; ++i) keys[i] = (int)(rng.next() % (uint64_t)(2 * n));
+
+        long found = 0;
+        double a0 = now_sec();
+        for(long i = 0; i < opt.ops; ++i) found += search_node(tree, keys[i]) != NULL;
+        double a1 = now_sec();
+        for(long i = 0; i < opt.ops; ++i) found += frozen_search(ft, keys[i]);
+        double a2 = now_sec();
+        std::vector<int> out(group);
+        std::vector<unsigned char> hit(group);
+        for(long i = 0; i < opt.ops; i += group){
+            long m = std::min(group, opt.ops - i);
+            frozen_lower_bound_many(ft, &keys[i], m, out.data(), hit.data());
+            for(long j = 0; j < m; ++j) found += hit[j] && out[j] == keys[i + j];
+        }
+        double a3 = now_sec();
+        sink = found;
+
+        printf("%10ld %12.2f %14.1f %14.1f %14.1f\n", n, (t1 - t0) * 1e3,
+            (a1 - a0) * 1e9 / opt.ops, (a2 - a1) * 1e9 / opt.ops, (a3 - a2) * 1e9 / opt.ops);
+        destroy_frozen(ft);
+        destroy_tree(tree);
+    }
+}
+
+// ------------------------- 磁盘映射 -------------------------
+// 映射中已经在内存里的页数对应的 MB
+static double resident_mb(const MappedTree* mt){
+    long page = sysconf(_SC_PAGESIZE);
+    size_t pages = (mt->map_len + page - 1) / page;
+    std::vector<unsigned char> vec(pages);
+    if(mincore(mt->map, mt->map_len, vec.data()) != 0) return -1;
+    size_t in = 0;
+    for(size_t i = 0; i < pages; ++i) in += vec[i] & 1;
+    return in * (double) page / (1 << 20);
+}
+
+/**
+ * 重启的两种方式：按有序 key 逐个 insert 重建，或 open_mapped 打开 save_tree 写出的文件。
+ * 打开前用 posix_fadvise 丢弃文件的 page cache（尽力而为），之后 1000 次随机查找为冷查找，
+ * 输出查找后映射中驻留的内存，最后是 search_node 与 mapped_search 的对比：
+ * mapped(1st) 第一遍查找包含缺页读入的时间，mapped 为同一组 key 的第二遍
+ */
+static void bench_mapped(const Options& opt){
+    static const char* path = "/tmp/rb_bench_mapped.rbt";
+    static const long cold = 1000;
+    printf("%10s %12s %10s %10s %12s %12s %12s %12s %12s\n", "n", "rebuild(ms)", "save(ms)", "open(us)",
+        "cold(us/op)", "resident(MB)", "search_node", "mapped(1st)", "mapped");
+    for(size_t s = 0; s < opt.sizes.size(); ++s){
+        long n = opt.sizes[s];
+        std::vector<int> sorted(n);
+        for(long i = 0; i < n; ++i) sorted[i] = (int)(i * 2);
+        RbTree* tree = build_from_sorted(sorted.data(), (int) n);
+
+        double t0 = now_sec();
+        RbTree* rebuilt = new_tree_with_allocator(new_slab_allocator(4096));
+        for(long i = 0; i < n; ++i) insert(rebuilt, sorted[i]);
+        double t1 = now_sec();
+        destroy_tree(rebuilt);
+        if(save_tree(tree, path) != 0) return;
+        double t2 = now_sec();
+
+        int fd = open(path, O_RDONLY);
+        if(fd >= 0){
+            posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+            close(fd);
+        }
+        double t3 = now_sec();
+        MappedTree* mt = open_mapped(path);
+        double t4 = now_sec();
+        if(!mt) return;
+
+        Rng rng(opt.seed);
+        long found = 0;
+        for(long i = 0; i < cold; ++i) found += mapped_search(mt, (int)(rng.next() % (uint64_t)(2 * n))) != NULL;
+        double t5 = now_sec();
+        double resident = resident_mb(mt);
+
+        std::vector<int> keys(opt.ops);
+        for(long i = 0; i < opt.ops; ++i) keys[i] = (int)(rng.next() % (uint64_t)(2 * n));
+        double a0 = now_sec();
+        for(long i = 0; i < opt.ops; ++i) found += search_node(tree, keys[i]) != NULL;
+        double a1 = now_sec();
+        for(long i = 0; i < opt.ops; ++i) found += mapped_search(mt, keys[i]) != NULL;
+        double a2 = now_sec();
+        for(long i = 0; i < opt.ops; ++i) found += mapped_search(mt, keys[i]) != NULL;
+        double a3 = now_sec();
+        sink = found;
+
+        printf("%10ld %12.2f %10.2f %10.1f %12.2f %12.2f %12.1f %12.1f %12.1f\n", n, (t1 - t0) * 1e3, (t2 - t1) * 1e3,
+            (t4 - t3) * 1e6, (t5 - t4) * 1e6 / cold, resident, (a1 - a0) * 1e9 / opt.ops,
+            (a2 - a1) * 1e9 / opt.ops, (a3 - a2) * 1e9 / opt.ops);
+        close_mapped(mt);
+        destroy_tree(tree);
+        unlink(path);
+    }
+}
+
+// ------------------------- 多线程分片 -------------------------
+/**
+ * 在 threads 个线程上并发执行 ops 次操作，每个线程各自的随机数序列，op(rng) 执行一次操作
+ * @return 每秒完成的操作数（百万）
+ */
+template<typename Op>
+static double run_threads(long threads, long ops, uint64_t seed, Op op){
+    std::vector<std::thread> pool;
+    double t0 = now_sec();
+    for(long t = 0; t < threads; ++t){
+        pool.push_back(std::thread([&, t](){
+            Rng rng(seed + t * 0x9e3779b97f4a7c15ULL);
+            for(long i = 0; i < ops / threads; ++i) op(rng);
+        }));
+    }
+    for(size_t t = 0; t < pool.size(); ++t) pool[t].join();
+    return ops / (now_sec() - t0) / 1e6;
+}
+
+/**
+ * 树中预先有 n 个偶数 key，每个线程在 [0, 2n) 上均匀随机地插入/删除各一半，
+ * 对比一把全局 mutex 保护的 RbTree 与分片树（分片数为最大线程数的 4 倍）的吞吐，speedup 相对于分片树的单线程
+ */
+static void bench_sharded(const Options& opt){
+    long max_threads = *std::max_element(opt.threads.begin(), opt.threads.end());
+    int shards = (int) std::max(4L, max_threads * 4);
+    printf("%10s %8s %16s %16s %8s %11s\n", "n", "threads", "mutex(Mops/s)", "sharded(Mops/s)", "speedup", "rebalances");
+    for(size_t s = 0; s < opt.sizes.size(); ++s){
+        long n = opt.sizes[s];
+        std::vector<int> sorted(n);
+        for(long i = 0; i < n; ++i) sorted[i] = (int)(i * 2);
+        double base = 0;
+
+        for(size_t t = 0; t < opt.threads.size(); ++t){
+            long threads = opt.threads[t];
+            RbTree* tree = build_from_sorted(sorted.data(), (int) n);
+            pthread_mutex_t mu = PTHREAD_MUTEX_INITIALIZER;
+            double locked = run_threads(threads, opt.ops, opt.seed, [&](Rng& rng){
+                uint64_t r = rng.next();
+                int k = (int)((r >> 1) % (uint64_t)(2 * n));
+                pthread_mutex_lock(&mu);
+                if(r & 1) insert(tree, k);
+                else delete_node(tree, k);
+                pthread_mutex_unlock(&mu);
+            });
+            destroy_tree(tree);
+
+            ShardedTree* st = new_sharded_tree(shards, 0, (int)(2 * n - 1));
+            for(long i = 0; i < n; ++i) sharded_insert(st, sorted[i]);
+            unsigned long r0 = st->rebalances;
+            double sharded = run_threads(threads, opt.ops, opt.seed, [&](Rng& rng){
+                uint64_t r = rng.next();
+                int k = (int)((r >> 1) % (uint64_t)(2 * n));
+                if(r & 1) sharded_insert(st, k);
+                else sharded_delete(st, k);
+            });
+            if(t == 0) base = sharded;
+            printf("%10ld %8ld %16.2f %16.2f %8.2f %11lu\n", n, threads, locked, sharded, sharded / base, st->rebalances - r0);
+            destroy_sharded_tree(st);
+        }
+    }
+}
+
+/**
+ * 读线程各做 ops / threads 次查找，同时一个写线程不停地随机插入/删除，直到读线程全部结束
+ * @return 读线程合计每秒完成的查找数（百万），*writes 为同一时间内写线程每秒完成的操作数（百万）
+ */
+template<typename Read, typename Write>
+static double run_readers(long threads, long ops, uint64_t seed, Read read, Write write, double* writes){
+    std::atomic<bool> done(false);
+    long written = 0;
+    std::thread writer([&](){
+        Rng rng(seed ^ 0x5bd1e995ULL);
+        while(!done.load(std::memory_order_relaxed)){
+            write(rng);
+            ++written;
+        }
+    });
+    double t0 = now_sec();
+    run_threads(threads, ops, seed, read);
+    double elapsed = now_sec() - t0;
+    done = true;
+    writer.join();
+    *writes = written / elapsed / 1e6;
+    return ops / elapsed / 1e6;
+}
+
+// 读线程的 latch tree 槽位，随 thread_local 在线程退出时析构
+struct LatchSlot{
+    LatchReader* reader;
+    LatchSlot() : reader(NULL) {}
+    ~LatchSlot(){ latch_unregister(reader); }
+};
+
+/**
+ * 树中预先有 [0, 2n) 中的 n 个偶数 key，读线程均匀随机地查找 [0, 2n)，写线程随机插入/删除奇数 key，
+ * 对比读写锁保护的 RbTree（读线程 rdlock + search_node）与 latch tree（读线程不加锁），
+ * scale 为相对于单个读线程的倍数
+ */
+static void bench_latch(const Options& opt){
+    printf("%10s %8s %14s %12s %14s %12s %8s\n", "n", "readers", "rwlock(Mops/s)", "writer", "latch(Mops/s)", "writer", "scale");
+    for(size_t s = 0; s < opt.sizes.size(); ++s){
+        long n = opt.sizes[s];
+        std::vector<int> sorted(n);
+        for(long i = 0; i < n; ++i) sorted[i] = (int)(i * 2);
+        double base = 0;
+
+        for(size_t t = 0; t < opt.threads.size(); ++t){
+            long threads = opt.threads[t];
+            if(threads > LATCH_MAX_READERS){
+                printf("# %ld readers exceed LATCH_MAX_READERS (%d), skipped\n", threads, LATCH_MAX_READERS);
+                continue;
+            }
+            RbTree* tree = build_from_sorted(sorted.data(), (int) n);
+            pthread_rwlock_t lock;
+            pthread_rwlock_init(&lock, NULL);
+            double locked_writes;
+            double locked = run_readers(threads, opt.ops, opt.seed, [&](Rng& rng){
+                int k = (int)(rng.next() % (uint64_t)(2 * n));
+                pthread_rwlock_rdlock(&lock);
+                search_node(tree, k);
+                pthread_rwlock_unlock(&lock);
+            }, [&](Rng& rng){
+                uint64_t r = rng.next();
+                int k = (int)((r >> 1) % (uint64_t) n) * 2 + 1;
+                pthread_rwlock_wrlock(&lock);
+                if(r & 1) insert(tree, k);
+                else delete_node(tree, k);
+                pthread_rwlock_unlock(&lock);
+            }, &locked_writes);
+            pthread_rwlock_destroy(&lock);
+            destroy_tree(tree);
+
+            LatchTree* lt = new_latch_tree();
+            for(long i = 0; i < n; ++i) latch_insert(lt, sorted[i]);
+            double latch_writes;
+            double latched = run_readers(threads, opt.ops, opt.seed, [&](Rng& rng){
+                // 每个读线程第一次查找时申请槽位，线程退出时归还，下一轮的读线程可以重新使用
+                static thread_local LatchSlot slot;
+                if(!slot.reader) slot.reader = latch_register(lt);
+                if(!slot.reader) return;
+                latch_contains(lt, slot.reader, (int)(rng.next() % (uint64_t)(2 * n)));
+            }, [&](Rng& rng){
+                uint64_t r = rng.next();
+                int k = (int)((r >> 1) % (uint64_t) n) * 2 + 1;
+                if(r & 1) latch_insert(lt, k);
+                else latch_delete(lt, k);
+            }, &latch_writes);
+            destroy_latch_tree(lt);
+
+            if(t == 0) base = latched;
+            printf("%10ld %8ld %14.2f %12.2f %14.2f %12.2f %8.2f\n", n, threads, locked, locked_writes, latched, latch_writes, latched / base);
+        }
+    }
+}
+
+// ------------------------- 集合运算 -------------------------
+// 两棵共用分配器的树，分别有 [0, 2n) 中的 n、m 个随机 key（有重复时略少）
+static void make_pair(long n, long m, uint64_t seed, RbTree** a, RbTree** b){
+    Rng rng(seed);
+    *a = new_tree_with_allocator(new_slab_allocator(4096));
+    *b = new_tree_sharing(*a);
+    for(long i = 0; i < n; ++i) insert(*a, (int)(rng.next() % (uint64_t)(2 * n)));
+    for(long i = 0; i < m; ++i) insert(*b, (int)(rng.next() % (uint64_t)(2 * n)));
+}
+
+static std::vector<int> keys_of(const RbTree* tree){
+    std::vector<int> keys;
+    keys.reserve(tree->size);
+    for(TNode* x = first_node(tree); x; x = next_node(x)) keys.push_back(x->value);
+    return keys;
+}
+
+/**
+ * m = n 与 m = n/1000 两种规模下，t1 与 t2 的并、交、差：
+ * 逐个 insert/delete_node（t1 = t1 op t2）与 tree_union/tree_intersection/tree_difference 对比，后者按 -t 的线程数分别运行；
+ * 最后是删除 t1 中 10% 的连续范围：逐个 delete_node 与 tree_delete_range 对比
+ */
+static void bench_setops(const Options& opt){
+    static const char* names[] = { "union", "intersect", "diff" };
+    printf("%10s %10s %-10s %8s %14s %10s %8s\n", "n", "m", "op", "threads", "elementwise(ms)", "join(ms)", "speedup");
+    for(size_t s = 0; s < opt.sizes.size(); ++s){
+        long n = opt.sizes[s];
+        const long ms[] = { n, std::max(1L, n / 1000) };
+        for(size_t mi = 0; mi < 2; ++mi){
+            long m = ms[mi];
+            for(int op = 0; op < 3; ++op){
+                RbTree *a, *b;
+                make_pair(n, m, opt.seed, &a, &b);
+                std::vector<int> kb = keys_of(b);
+                double t0 = now_sec();
+                if(op == 0){
+                    for(size_t i = 0; i < kb.size(); ++i) insert(a, kb[i]);
+                } else if(op == 1){
+                    std::vector<int> ka = keys_of(a);
+                    for(size_t i = 0; i < ka.size(); ++i)
+                        if(!search_node(b, ka[i])) delete_node(a, ka[i]);
+                } else {
+                    for(size_t i = 0; i < kb.size(); ++i) delete_node(a, kb[i]);
+                }
+                double single = now_sec() - t0;
+                size_t expect = a->size;
+                destroy_tree(b);
+                destroy_tree(a);
+
+                for(size_t t = 0; t < opt.threads.size(); ++t){
+                    make_pair(n, m, opt.seed, &a, &b);
+                    set_op_threads((int) opt.threads[t]);
+                    double t1 = now_sec();
+                    if(op == 0) tree_union(a, b);
+                    else if(op == 1) tree_intersection(a, b);
+                    else tree_difference(a, b);
+                    double joined = now_sec() - t1;
+                    if(a->size != expect) printf("# size mismatch %zu != %zu\n", a->size, expect);
+                    printf("%10ld %10ld %-10s %8ld %14.2f %10.2f %8.2f\n", n, m, names[op], opt.threads[t],
+                        single * 1e3, joined * 1e3, single / joined);
+                    destroy_tree(b);
+                    destroy_tree(a);
+                }
+            }
+        }
+
+        RbTree *a, *b;
+        make_pair(n, 0, opt.seed, &a, &b);
+        int lo = (int)(n / 2), hi = (int)(n / 2 + n / 5);
+        std::vector<int> ka = keys_of(a);
+        double t0 = now_sec();
+        for(size_t i = 0; i < ka.size(); ++i)
+            if(ka[i] >= lo && ka[i] <= hi) delete_node(a, ka[i]);
+        double single = now_sec() - t0;
+        destroy_tree(b);
+        destroy_tree(a);
+        make_pair(n, 0, opt.seed, &a, &b);
+        double t1 = now_sec();
+        tree_delete_range(a, lo, hi);
+        double ranged = now_sec() - t1;
+        printf("%10ld %10s %-10s %8d %14.2f %10.2f %8.2f\n", n, "-", "delrange", 1, single * 1e3, ranged * 1e3, single / ranged);
+        destroy_tree(b);
+        destroy_tree(a);
+    }
+}
+
+/**
+ * 随机插入 n 个 key 后导出整棵树，输出都重定向到 /dev/null，只比较格式化和系统调用的开销：
+ * visit_tree（printf，stdout 全缓冲）与 dump_tree 经 1MB 缓冲区写 fd 的三种格式，另外给出文本的总字节数
+ */
+static void bench_dump(const Options& opt){
+    const size_t cap = 1 << 20;
+    std::vector<char> buf(cap);
+    printf("%10s %8s %12s %12s %8s %12s %12s %10s\n", "n", "order", "printf(ms)", "text(ms)", "speedup", "binary(ms)", "dot(ms)", "text(MB)");
+    for(size_t s = 0; s < opt.sizes.size(); ++s){
+        long n = opt.sizes[s];
+        Rng rng(opt.seed);
+        RbTree* t = new_tree_with_allocator(new_slab_allocator(4096));
+        for(long i = 0; i < n; ++i) insert(t, (int)(rng.next() % (uint64_t)(2 * n)));
+
+        static const Order orders[] = { pre, middle, post };
+        static const char* names[] = { "pre", "middle", "post" };
+        for(int k = 0; k < 3; ++k){
+            fflush(stdout);
+            int saved = dup(STDOUT_FILENO);
+            int null_fd = open("/dev/null", O_WRONLY);
+            dup2(null_fd, STDOUT_FILENO);
+            double t0 = now_sec();
+            visit_tree(t, orders[k]);
+            fflush(stdout);
+            double t1 = now_sec();
+            dup2(saved, STDOUT_FILENO);
+            close(saved);
+
+            DumpOptions o;
+            memset(&o, 0, sizeof(o));
+            o.order = orders[k];
+            o.format = DUMP_TEXT;
+            double t2 = now_sec();
+            long long bytes = dump_tree(t, &o, null_fd, buf.data(), cap);
+            double t3 = now_sec();
+            o.format = DUMP_BINARY;
+            dump_tree(t, &o, null_fd, buf.data(), cap);
+            double t4 = now_sec();
+            o.format = DUMP_DOT;
+            dump_tree(t, &o, null_fd, buf.data(), cap);
+            double t5 = now_sec();
+            close(null_fd);
+            printf("%10ld %8s %12.2f %12.2f %8.2f %12.2f %12.2f %10.1f\n", n, names[k], (t1 - t0) * 1e3, (t3 - t2) * 1e3,
+                (t1 - t0) / (t3 - t2), (t4 - t3) * 1e3, (t5 - t4) * 1e3, bytes / 1048576.0);
+        }
+        destroy_tree(t);
+    }
+}
+
+// ------------------------- 内存重排 -------------------------
+// 查找命中的 ns/op 与从最小节点 next_node 遍历到底的 ns/node
+static void measure_layout(RbTree* t, const std::vector<int>& probe, double* search_ns, double* scan_ns){
+    long found = 0;
+    double t0 = now_sec();
+    for(size_t i = 0; i < probe.size(); ++i) found += search_node(t, probe[i]) != NULL;
+    double t1 = now_sec();
+    for(TNode* n = first_node(t); n; n = next_node(n)) found += n->value & 1;
+    double t2 = now_sec();
+    sink = found;
+    *search_ns = (t1 - t0) * 1e9 / probe.size();
+    *scan_ns = (t2 - t1) * 1e9 / t->size;
+}
+
+/**
+ * 随机插入 n 个 key，再做 n 轮随机删除 + 插入把节点在内存中打散，之后对比 relayout 前后的查找和有序遍历：
+ * churned 为打散后的状态，bfs/veb 为整体重排之后，step 为再次打散后每次 relayout_step 处理 4096 个节点直到结束，
+ * 输出重排总耗时、单次 relayout_step 的最长耗时和堆内存使用量（重排后旧的 slab 整体还给分配器）
+ */
+static void bench_relayout(const Options& opt){
+    static const size_t step_budget = 4096;
+    printf("%10s %8s %13s %13s %12s %12s %9s\n", "n", "layout", "relayout(ms)", "max-step(us)", "search(ns)", "scan(ns)", "heap(MB)");
+    for(size_t s = 0; s < opt.sizes.size(); ++s){
+        long n = opt.sizes[s];
+        Rng rng(opt.seed);
+        RbTree* t = new_tree_with_allocator(new_slab_allocator(4096));
+        std::vector<int> keys;
+        keys.reserve(n);
+        while((long) keys.size() < n){
+            int k = (int)(rng.next() % (uint64_t)(4 * n));
+            if(insert(t, k) == 1) keys.push_back(k);
+        }
+        // 打散：删除一个随机的 key，新插入的节点复用它的位置，与树中的邻居不再相邻
+        for(int round = 0; round < 2; ++round){
+            for(long i = 0; i < n; ++i){
+                size_t j = rng.next() % keys.size();
+                delete_node(t, keys[j]);
+                int k;
+                do k = (int)(rng.next() % (uint64_t)(4 * n)); while(insert(t, k) != 1);
+                keys[j] = k;
+            }
+        }
+        std::vector<int> probe(opt.ops);
+        for(long i = 0; i < opt.ops; ++i) probe[i] = keys[rng.next() % keys.size()];
+
+        double search_ns, scan_ns;
+        measure_layout(t, probe, &search_ns, &scan_ns);
+        printf("%10ld %8s %13s %13s %12.1f %12.1f %9.1f\n", n, "churned", "-", "-", search_ns, scan_ns, heap_in_use() / 1048576.0);
+
+        static const RelayoutOrder orders[] = { RELAYOUT_BFS, RELAYOUT_VEB };
+        static const char* names[] = { "bfs", "veb" };
+        for(int k = 0; k < 2; ++k){
+            double t0 = now_sec();
+            relayout(t, orders[k], NULL, NULL);
+            double t1 = now_sec();
+            measure_layout(t, probe, &search_ns, &scan_ns);
+            printf("%10ld %8s %13.2f %13s %12.1f %12.1f %9.1f\n", n, names[k], (t1 - t0) * 1e3, "-", search_ns, scan_ns, heap_in_use() / 1048576.0);
+        }
+
+        for(long i = 0; i < n; ++i){
+            size_t j = rng.next() % keys.size();
+            delete_node(t, keys[j]);
+            int k;
+            do k = (int)(rng.next() % (uint64_t)(4 * n)); while(insert(t, k) != 1);
+            keys[j] = k;
+        }
+        for(long i = 0; i < opt.ops; ++i) probe[i] = keys[rng.next() % keys.size()];
+        measure_layout(t, probe, &search_ns, &scan_ns);
+        printf("%10ld %8s %13s %13s %12.1f %12.1f %9.1f\n", n, "churned", "-", "-", search_ns, scan_ns, heap_in_use() / 1048576.0);
+        double total = 0, worst = 0;
+        for(;;){
+            double t0 = now_sec();
+            size_t done = relayout_step(t, step_budget, NULL, NULL);
+            double t1 = now_sec();
+            total += t1 - t0;
+            worst = std::max(worst, t1 - t0);
+            if(!done) break;
+        }
+        measure_layout(t, probe, &search_ns, &scan_ns);
+        printf("%10ld %8s %13.2f %13.1f %12.1f %12.1f %9.1f\n", n, "step", total * 1e3, worst * 1e6, search_ns, scan_ns, heap_in_use() / 1048576.0);
+        destroy_tree(t);
+    }
+}
+
+// ------------------------- 批量查找 -------------------------
+/**
+ * 随机顺序插入 n 个偶数 key（节点在内存中的位置与树中的位置无关），ops 个随机 key 一半命中，
+ * 对比逐个 search_node 与每批 32/64/256 个 key 的 search_many，输出每个 key 的 ns，树要大于 LLC 才能看出差别
+ */
+static void bench_many(const Options& opt){
+    static const size_t batches[] = { 32, 64, 256 };
+    printf("%10s %10s %12s %12s %12s %12s %8s\n", "n", "tree(MB)", "search_node", "many(32)", "many(64)", "many(256)", "speedup");
+    for(size_t s = 0; s < opt.sizes.size(); ++s){
+        long n = opt.sizes[s];
+        Rng rng(opt.seed);
+        std::vector<int> order(n);
+        for(long i = 0; i < n; ++i) order[i] = (int)(i * 2);
+        for(long i = n - 1; i > 0; --i) std::swap(order[i], order[rng.next() % (uint64_t)(i + 1)]);
+        RbTree* t = new_tree_with_allocator(new_slab_allocator(4096));
+        for(long i = 0; i < n; ++i) insert(t, order[i]);
+        std::vector<int>().swap(order);
+
+        std::vector<int> keys(opt.ops);
+        for(long i = 0; i < opt.ops; ++i) keys[i] = (int)(rng.next() % (uint64_t)(2 * n));
+        std::vector<TNode*> out(256);
+
+        long found = 0;
+        double t0 = now_sec();
+        for(long i = 0; i < opt.ops; ++i) found += search_node(t, keys[i]) != NULL;
+        double t1 = now_sec();
+        double seq = (t1 - t0) * 1e9 / opt.ops;
+        double many[3];
+        for(int b = 0; b < 3; ++b){
+            double a0 = now_sec();
+            for(long i = 0; i < opt.ops; i += batches[b]){
+                size_t m = std::min((long) batches[b], opt.ops - i);
+                found += search_many(t, &keys[i], m, out.data());
+            }
+            double a1 = now_sec();
+            many[b] = (a1 - a0) * 1e9 / opt.ops;
+        }
+        sink = found;
+        printf("%10ld %10.1f %12.1f %12.1f %12.1f %12.1f %8.2f\n", n, n * sizeof(TNode) / 1048576.0,
+            seq, many[0], many[1], many[2], seq / many[2]);
+        destroy_tree(t);
+    }
+}
+
+// ------------------------- 参数解析 -------------------------
+static std::vector<std::string> split(const char* s){
+    std::vector<std::string> out;
+    std::string cur;
+    for(; *s; ++s){
+        if(*s == ','){
+            if(!cur.empty()) out.push_back(cur);
+            cur.clear();
+        } else {
+            cur += *s;
+        }
+    }
+    if(!cur.empty()) out.push_back(cur);
+    return out;
+}
+
+// 支持 1000、10K、1M、100M 这样的写法
+static long parse_count(const std::string& s){
+    char* end = NULL;
+    double v = strtod(s.c_str(), &end);
+    if(end && (*end == 'k' || *end == 'K')) v *= 1e3;
+    else if(end && (*end == 'm' || *end == 'M')) v *= 1e6;
+    return (long) v;
+}
+
+static void usage(const char* prog){
+    fprintf(stderr, "usage: %s [build|hint|relaxed|batch|frozen|mapped|setops|sharded|latch|dump|timer|relayout|many] [-w seq,random,zipf,mixed] [-n 1K,1M,100M] [-o ops] "
+        "[-i rb,slab,ptree,cptr,cidx,td,map] [-r read%%] [-s seed] [-t 1,2,4]\n", prog);
+}
+
+int main(int argc, char** argv){
+    Options opt;
+    bool build = false, hint = false, relaxed = false, batch = false, frozen = false, mapped = false, setops = false, sharded = false, dump = false, timer = false, latch = false, relayout = false, many = false;
+    for(int i = 1; i < argc; ++i){
+        std::string a = argv[i];
+        if(a == "build"){ build = true; continue; }
+        if(a == "hint"){ hint = true; continue; }
+        if(a == "relaxed"){ relaxed = true; continue; }
+        if(a == "batch"){ batch = true; continue; }
+        if(a == "frozen"){ frozen = true; continue; }
+        if(a == "mapped"){ mapped = true; continue; }
+        if(a == "setops"){ setops = true; continue; }
+        if(a == "sharded"){ sharded = true; continue; }
+        if(a == "dump"){ dump = true; continue; }
+        if(a == "timer"){ timer = true; continue; }
+        if(a == "latch"){ latch = true; continue; }
+        if(a == "relayout"){ relayout = true; continue; }
+        if(a == "many"){ many = true; continue; }
+        if(i + 1 >= argc){ usage(argv[0]); return 1; }
+        if(a == "-w") opt.workloads = split(argv[++i]);
+        else if(a == "-i") opt.impls = split(argv[++i]);
+        else if(a == "-o") opt.ops = parse_count(argv[++i]);
+        else if(a == "-r") opt.read_pct = atoi(argv[++i]);
+        else if(a == "-s") opt.seed = strtoull(argv[++i], NULL, 10);
+        else if(a == "-n"){
+            std::vector<std::string> v = split(argv[++i]);
+            opt.sizes.clear();
+            for(size_t j = 0; j < v.size(); ++j) opt.sizes.push_back(parse_count(v[j]));
+        } else if(a == "-t"){
+            std::vector<std::string> v = split(argv[++i]);
+            opt.threads.clear();
+            for(size_t j = 0; j < v.size(); ++j) opt.threads.push_back(std::max(1L, parse_count(v[j])));
+        } else { usage(argv[0]); return 1; }
+    }
+
+    if(build){
+        bench_build(opt);
+        return 0;
+    }
+    if(hint){
+        bench_hint(opt);
+        return 0;
+    }
+    if(relaxed){
+        bench_relaxed(opt);
+        return 0;
+    }
+    if(batch){
+        bench_batch(opt);
+        return 0;
+    }
+    if(frozen){
+        bench_frozen(opt);
+        return 0;
+    }
+    if(mapped){
+        bench_mapped(opt);
+        return 0;
+    }
+    if(setops){
+        bench_setops(opt);
+        return 0;
+    }
+    if(sharded){
+        bench_sharded(opt);
+        return 0;
+    }
+    if(dump){
+        bench_dump(opt);
+        return 0;
+    }
+    if(timer){
+        bench_timer(opt);
+        return 0;
+    }
+    if(latch){
+        bench_latch(opt);
+        return 0;
+    }
+    if(relayout){
+        bench_relayout(opt);
+        return 0;
+    }
+    if(many){
+        bench_many(opt);
+        return 0;
+    }
+
+    PerfCounters pc;
+    if(!pc.ok) printf("# perf_event_open unavailable, hardware counters disabled\n");
+    printf("# latency sampled every %ld ops, includes timer overhead\n", SAMPLE_MASK + 1);
+    printf("%-5s %-7s %10s %-8s %10s %9s %8s %8s %6s %7s %9s %9s %9s\n",
+        "impl", "load", "n", "phase", "ops", "ns/op", "p50", "p99", "height", "rot/op", "rss(MB)", "llc-miss", "br-miss");
+
+    for(size_t s = 0; s < opt.sizes.size(); ++s){
+        for(size_t w = 0; w < opt.workloads.size(); ++w){
+            for(size_t m = 0; m < opt.impls.size(); ++m){
+                const std::string& impl = opt.impls[m];
+                if(impl == "rb" || impl == "slab"){
+                    RbImpl rb(impl == "slab");
+                    run_workload(impl.c_str(), rb, opt.workloads[w], opt.sizes[s], opt, pc);
+                } else if(impl == "ptree"){
+                    PTreeImpl ptree;
+                    run_workload("ptree", ptree, opt.workloads[w], opt.sizes[s], opt, pc);
+                } else if(impl == "cptr"){
+                    CPtrImpl cptr;
+                    run_workload("cptr", cptr, opt.workloads[w], opt.sizes[s], opt, pc);
+                } else if(impl == "cidx"){
+                    CIdxImpl cidx;
+                    run_workload("cidx", cidx, opt.workloads[w], opt.sizes[s], opt, pc);
+                } else if(impl == "td"){
+                    TDImpl td;
+                    run_workload("td", td, opt.workloads[w], opt.sizes[s], opt, pc);
+                } else if(impl == "map"){
+                    MapImpl map;
+                    run_workload("map", map, opt.workloads[w], opt.sizes[s], opt, pc);
+                }
+            }
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,183 @@
+/*
+ * 内存紧凑的红黑树，说明见 red_black_tree_compact.h
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include "red_black_tree_compact.h"
+
+// ------------------------- 指针 + 颜色位压缩 -------------------------
+#define CPTR_CHUNK_NODES 4096
+
+static CPtrNode* cptr_alloc(CPtrTree* t){
+    CPtrNode* n = t->free_list;
+    if(n){
+        t->free_list = n->left;
+        return n;
+    }
+    if(!t->chunks || t->chunk_used == CPTR_CHUNK_NODES){
+        CPtrChunk* c = (CPtrChunk*) malloc(sizeof(CPtrChunk) + CPTR_CHUNK_NODES * sizeof(CPtrNode));
+        if(!c){
+            perror("create node error.");
+            return NULL;
+        }
+        c->next = t->chunks;
+        t->chunks = c;
+        t->chunk_used = 0;
+    }
+    return &t->chunks->nodes[t->chunk_used++];
+}
+
+static void cptr_free(CPtrTree* t, CPtrNode* n){
+    n->left = t->free_list;
+    t->free_list = n;
+}
+
+typedef CPtrNode* CPtrRef;
+
+#define CRB_TREE            CPtrTree
+#define CRB_REF             CPtrRef
+#define CRB_NIL             NULL
+#define CRB_FN(name)        cptr_##name
+#define CRB_L(t, r)         ((r)->left)
+#define CRB_R(t, r)         ((r)->right)
+#define CRB_PC(t, r)        ((r)->parent_color)
+#define CRB_VAL(t, r)       ((r)->value)
+#define CRB_PC_PARENT(pc)   ((CPtrNode*) ((pc) & ~(uintptr_t) 1))
+#define CRB_PC_MAKE(p, c)   ((uintptr_t) (p) | (uintptr_t) (c))
+#define CRB_ALLOC(t)        cptr_alloc(t)
+#define CRB_FREE(t, r)      cptr_free(t, r)
+#include "red_black_tree_compact_impl.h"
+#undef CRB_TREE
+#undef CRB_REF
+#undef CRB_NIL
+#undef CRB_FN
+#undef CRB_L
+#undef CRB_R
+#undef CRB_PC
+#undef CRB_VAL
+#undef CRB_PC_PARENT
+#undef CRB_PC_MAKE
+#undef CRB_ALLOC
+#undef CRB_FREE
+
+CPtrTree* new_cptr_tree(){
+    CPtrTree* t = (CPtrTree*) malloc(sizeof(CPtrTree));
+    if(!t){
+        perror("create tree error.");
+        return NULL;
+    }
+    t->root = NULL;
+    t->chunks = NULL;
+    t->chunk_used = 0;
+    t->free_list = NULL;
+    t->size = 0;
+    t->rotations = 0;
+    return t;
+}
+
+void destroy_cptr_tree(CPtrTree* t){
+    if(!t) return;
+    CPtrChunk* c = t->chunks;
+    while(c){
+        CPtrChunk* next = c->next;
+        free(c);
+        c = next;
+    }
+    free(t);
+}
+
+// 已申请的节点内存（按块计算）
+size_t cptr_memory(const CPtrTree* t){
+    size_t bytes = sizeof(CPtrTree);
+    const CPtrChunk* c;
+    for(c = t->chunks; c; c = c->next)
+        bytes += sizeof(CPtrChunk) + CPTR_CHUNK_NODES * sizeof(CPtrNode);
+    return bytes;
+}
+
+// ------------------------- 32 位下标 -------------------------
+// parent_color 中下标占 31 位
+#define CIDX_MAX_NODES 0x7fffffffu
+
+static uint32_t cidx_alloc(CIdxTree* t){
+    uint32_t n = t->free_list;
+    if(n){
+        t->free_list = t->nodes[n].left;
+        return n;
+    }
+    if(t->used == t->capacity){
+        if(t->capacity >= CIDX_MAX_NODES) return 0;
+        uint32_t cap = t->capacity > CIDX_MAX_NODES / 2 ? CIDX_MAX_NODES : t->capacity * 2;
+        CIdxNode* nodes = (CIdxNode*) realloc(t->nodes, (size_t) cap * sizeof(CIdxNode));
+        if(!nodes){
+            perror("create node error.");
+            return 0;
+        }
+        t->nodes = nodes;
+        t->capacity = cap;
+    }
+    return t->used++;
+}
+
+static void cidx_free(CIdxTree* t, uint32_t n){
+    t->nodes[n].left = t->free_list;
+    t->free_list = n;
+}
+
+// 下标在每次访问时都重新经过 t->nodes，插入时数组扩容不影响已有的下标
+#define CRB_TREE            CIdxTree
+#define CRB_REF             uint32_t
+#define CRB_NIL             0u
+#define CRB_FN(name)        cidx_##name
+#define CRB_L(t, r)         ((t)->nodes[r].left)
+#define CRB_R(t, r)         ((t)->nodes[r].right)
+#define CRB_PC(t, r)        ((t)->nodes[r].parent_color)
+#define CRB_VAL(t, r)       ((t)->nodes[r].value)
+#define CRB_PC_PARENT(pc)   ((pc) >> 1)
+#define CRB_PC_MAKE(p, c)   (((uint32_t) (p) << 1) | (uint32_t) (c))
+#define CRB_ALLOC(t)        cidx_alloc(t)
+#define CRB_FREE(t, r)      cidx_free(t, r)
+#include "red_black_tree_compact_impl.h"
+#undef CRB_TREE
+#undef CRB_REF
+#undef CRB_NIL
+#undef CRB_FN
+#undef CRB_L
+#undef CRB_R
+#undef CRB_PC
+#undef CRB_VAL
+#undef CRB_PC_PARENT
+#undef CRB_PC_MAKE
+#undef CRB_ALLOC
+#undef CRB_FREE
+
+CIdxTree* new_cidx_tree(){
+    CIdxTree* t = (CIdxTree*) malloc(sizeof(CIdxTree));
+    if(!t){
+        perror("create tree error.");
+        return NULL;
+    }
+    t->capacity = 1024;
+    t->nodes = (CIdxNode*) malloc(t->capacity * sizeof(CIdxNode));
+    if(!t->nodes){
+        perror("create tree error.");
+        free(t);
+        return NULL;
+    }
+    t->root = 0;
+    t->used = 1;   // 下标 0 表示空
+    t->free_list = 0;
+    t->size = 0;
+    t->rotations = 0;
+    return t;
+}
+
+void destroy_cidx_tree(CIdxTree* t){
+    if(!t) return;
+    free(t->nodes);
+    free(t);
+}
+
+size_t cidx_memory(const CIdxTree* t){
+    return sizeof(CIdxTree) + (size_t) t->capacity * sizeof(CIdxNode);
+}
@@ -0,0 +1,84 @@
+/*
+ * 内存紧凑的红黑树
+ *
+ * TNode 有 left/right/parent 三个 8 字节指针、4 字节的 Color、4 字节的 value 以及附加信息，
+ * 保存 4 字节的 key 需要 40 字节。这里提供两种紧凑的布局：
+ *
+ * CPtrTree：和 Linux kernel 的 __rb_parent_color 一样，把颜色放在 parent 指针的最低位
+ *           （节点至少 4 字节对齐，最低位恒为 0），节点为 left/right/parent_color + value，共 32 字节
+ * CIdxTree：节点统一放在一个数组中，用 32 位下标代替 64 位指针，下标 0 表示空，
+ *           parent_color 为 (parent 下标 << 1) | color，节点只有 16 字节，最多 2^31 - 1 个节点
+ *
+ * 两种布局的旋转、插入调整、删除调整的逻辑与 red_black_tree.c 完全一致，
+ * 由 red_black_tree_compact_impl.h 按不同的链接方式各生成一份。
+ */
+#ifndef RED_BLACK_TREE_COMPACT_H
+#define RED_BLACK_TREE_COMPACT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// ------------------------- 指针 + 颜色位压缩 -------------------------
+typedef struct CPtrNode{
+    struct CPtrNode* left;
+    struct CPtrNode* right;
+    uintptr_t parent_color;   // parent 指针 | color
+    int value;
+} CPtrNode;
+
+// 节点按块分配，回收的节点通过 left 串成空闲链表
+typedef struct CPtrChunk{
+    struct CPtrChunk* next;
+    CPtrNode nodes[];
+} CPtrChunk;
+
+typedef struct CPtrTree{
+    CPtrNode* root;
+    CPtrChunk* chunks;
+    size_t chunk_used;        // 表头块中已切出的节点数
+    CPtrNode* free_list;
+    size_t size;
+    unsigned long rotations;  // 累计的旋转次数
+} CPtrTree;
+
+CPtrTree* new_cptr_tree();
+void destroy_cptr_tree(CPtrTree* tree);
+int cptr_insert(CPtrTree* tree, int value);
+int cptr_delete(CPtrTree* tree, int value);
+int cptr_contains(const CPtrTree* tree, int value);
+size_t cptr_memory(const CPtrTree* tree);
+
+// ------------------------- 32 位下标 -------------------------
+typedef struct CIdxNode{
+    uint32_t left;
+    uint32_t right;
+    uint32_t parent_color;    // (parent << 1) | color
+    int value;
+} CIdxNode;
+
+typedef struct CIdxTree{
+    CIdxNode* nodes;          // nodes[0] 不使用，下标 0 表示空
+    uint32_t root;
+    uint32_t capacity;
+    uint32_t used;            // 已经切出的最大下标 + 1
+    uint32_t free_list;       // 回收的节点，通过 left 串联
+    size_t size;
+    unsigned long rotations;  // 累计的旋转次数
+} CIdxTree;
+
+CIdxTree* new_cidx_tree();
+void destroy_cidx_tree(CIdxTree* tree);
+int cidx_insert(CIdxTree* tree, int value);
+int cidx_delete(CIdxTree* tree, int value);
+int cidx_contains(const CIdxTree* tree, int value);
+size_t cidx_memory(const CIdxTree* tree);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,243 @@
+/*
+ * 紧凑红黑树的算法部分，由 red_black_tree_compact.c 按两种链接方式各包含一次，不单独使用
+ *
+ * 包含前需要定义：
+ *   CRB_TREE / CRB_REF / CRB_NIL   树类型、节点引用类型、空引用
+ *   CRB_FN(name)                   生成的函数名
+ *   CRB_L(t, r) / CRB_R(t, r)      左右孩子（左值）
+ *   CRB_PC(t, r)                   parent_color（左值）
+ *   CRB_VAL(t, r)                  value（左值）
+ *   CRB_PC_PARENT(pc)              从 parent_color 中取出 parent
+ *   CRB_PC_MAKE(p, color)          由 parent 和颜色组成 parent_color
+ *   CRB_ALLOC(t) / CRB_FREE(t, r)  申请、回收节点
+ */
+
+#define CRB_BLACK 0
+#define CRB_RED   1
+
+static inline CRB_REF CRB_FN(parent)(const CRB_TREE* t, CRB_REF n){
+    return CRB_PC_PARENT(CRB_PC(t, n));
+}
+
+static inline int CRB_FN(color)(const CRB_TREE* t, CRB_REF n){
+    return n == CRB_NIL ? CRB_BLACK : (int)(CRB_PC(t, n) & 1);
+}
+
+static inline void CRB_FN(set_parent)(CRB_TREE* t, CRB_REF n, CRB_REF p){
+    CRB_PC(t, n) = CRB_PC_MAKE(p, CRB_PC(t, n) & 1);
+}
+
+static inline void CRB_FN(set_color)(CRB_TREE* t, CRB_REF n, int color){
+    CRB_PC(t, n) = (CRB_PC(t, n) & ~1) | color;
+}
+
+// 左旋，与 red_black_tree.c 中的 left_rotate 相同
+static void CRB_FN(left_rotate)(CRB_TREE* t, CRB_REF node){
+    CRB_REF pNode = CRB_FN(parent)(t, node);
+    CRB_REF rNode = CRB_R(t, node);
+
+    if(pNode == CRB_NIL) t->root = rNode;
+    else if(node == CRB_L(t, pNode)) CRB_L(t, pNode) = rNode;
+    else CRB_R(t, pNode) = rNode;
+    CRB_FN(set_parent)(t, rNode, pNode);
+
+    CRB_R(t, node) = CRB_L(t, rNode);
+    if(CRB_L(t, rNode) != CRB_NIL) CRB_FN(set_parent)(t, CRB_L(t, rNode), node);
+    CRB_L(t, rNode) = node;
+    CRB_FN(set_parent)(t, node, rNode);
+    t->rotations++;
+}
+
+// 右旋，与 red_black_tree.c 中的 right_rotate 相同
+static void CRB_FN(right_rotate)(CRB_TREE* t, CRB_REF node){
+    CRB_REF pNode = CRB_FN(parent)(t, node);
+    CRB_REF lNode = CRB_L(t, node);
+
+    if(pNode == CRB_NIL) t->root = lNode;
+    else if(node == CRB_R(t, pNode)) CRB_R(t, pNode) = lNode;
+    else CRB_L(t, pNode) = lNode;
+    CRB_FN(set_parent)(t, lNode, pNode);
+
+    CRB_L(t, node) = CRB_R(t, lNode);
+    if(CRB_R(t, lNode) != CRB_NIL) CRB_FN(set_parent)(t, CRB_R(t, lNode), node);
+    CRB_R(t, lNode) = node;
+    CRB_FN(set_parent)(t, node, lNode);
+    t->rotations++;
+}
+
+// insert_adjust 的循环版本
+static void CRB_FN(insert_adjust)(CRB_TREE* t, CRB_REF node){
+    CRB_REF p, g, u;
+    while((p = CRB_FN(parent)(t, node)) != CRB_NIL && CRB_FN(color)(t, p) == CRB_RED){
+        g = CRB_FN(parent)(t, p);
+        u = p == CRB_L(t, g) ? CRB_R(t, g) : CRB_L(t, g);
+        if(CRB_FN(color)(t, u) == CRB_RED){
+            CRB_FN(set_color)(t, g, CRB_RED);
+            CRB_FN(set_color)(t, p, CRB_BLACK);
+            CRB_FN(set_color)(t, u, CRB_BLACK);
+            node = g;
+            continue;
+        }
+        if(node == CRB_R(t, p) && p == CRB_L(t, g)){
+            CRB_FN(left_rotate)(t, p);
+            node = CRB_L(t, node);
+        } else if(node == CRB_L(t, p) && p == CRB_R(t, g)){
+            CRB_FN(right_rotate)(t, p);
+            node = CRB_R(t, node);
+        }
+        p = CRB_FN(parent)(t, node);
+        CRB_FN(set_color)(t, p, CRB_BLACK);
+        CRB_FN(set_color)(t, g, CRB_RED);
+        if(node == CRB_R(t, p)) CRB_FN(left_rotate)(t, g);
+        else CRB_FN(right_rotate)(t, g);
+        break;
+    }
+    CRB_FN(set_color)(t, t->root, CRB_BLACK);
+}
+
+// 与 red_black_tree.c 中的 delete_adjust 相同
+static void CRB_FN(delete_adjust)(CRB_TREE* t, CRB_REF parent, CRB_REF child){
+    CRB_REF brother;
+    while(CRB_FN(color)(t, child) == CRB_BLACK && child != t->root){
+        if(child == CRB_L(t, parent)){
+            brother = CRB_R(t, parent);
+            if(CRB_FN(color)(t, brother) == CRB_RED){
+                CRB_FN(set_color)(t, brother, CRB_BLACK);
+                CRB_FN(set_color)(t, parent, CRB_RED);
+                CRB_FN(left_rotate)(t, parent);
+                brother = CRB_R(t, parent);
+            }
+            if(CRB_FN(color)(t, CRB_L(t, brother)) == CRB_BLACK && CRB_FN(color)(t, CRB_R(t, brother)) == CRB_BLACK){
+                CRB_FN(set_color)(t, brother, CRB_RED);
+                child = parent;
+                parent = CRB_FN(parent)(t, parent);
+            } else {
+                if(CRB_FN(color)(t, CRB_R(t, brother)) == CRB_BLACK){
+                    CRB_FN(set_color)(t, CRB_L(t, brother), CRB_BLACK);
+                    CRB_FN(set_color)(t, brother, CRB_RED);
+                    CRB_FN(right_rotate)(t, brother);
+                    brother = CRB_R(t, parent);
+                }
+                CRB_FN(set_color)(t, brother, CRB_FN(color)(t, parent));
+                CRB_FN(set_color)(t, parent, CRB_BLACK);
+                if(CRB_R(t, brother) != CRB_NIL) CRB_FN(set_color)(t, CRB_R(t, brother), CRB_BLACK);
+                CRB_FN(left_rotate)(t, parent);
+                child = t->root;
+                break;
+            }
+        } else {
+            brother = CRB_L(t, parent);
+            if(CRB_FN(color)(t, brother) == CRB_RED){
+                CRB_FN(set_color)(t, brother, CRB_BLACK);
+                CRB_FN(set_color)(t, parent, CRB_RED);
+                CRB_FN(right_rotate)(t, parent);
+                brother = CRB_L(t, parent);
+            }
+            if(CRB_FN(color)(t, CRB_R(t, brother)) == CRB_BLACK && CRB_FN(color)(t, CRB_L(t, brother)) == CRB_BLACK){
+                CRB_FN(set_color)(t, brother, CRB_RED);
+                child = parent;
+                parent = CRB_FN(parent)(t, parent);
+            } else {
+                if(CRB_FN(color)(t, CRB_L(t, brother)) == CRB_BLACK){
+                    CRB_FN(set_color)(t, CRB_R(t, brother), CRB_BLACK);
+                    CRB_FN(set_color)(t, brother, CRB_RED);
+                    CRB_FN(left_rotate)(t, brother);
+                    brother = CRB_L(t, parent);
+                }
+                CRB_FN(set_color)(t, brother, CRB_FN(color)(t, parent));
+                CRB_FN(set_color)(t, parent, CRB_BLACK);
+                if(CRB_L(t, brother) != CRB_NIL) CRB_FN(set_color)(t, CRB_L(t, brother), CRB_BLACK);
+                CRB_FN(right_rotate)(t, parent);
+                child = t->root;
+                break;
+            }
+        }
+    }
+    if(child != CRB_NIL) CRB_FN(set_color)(t, child, CRB_BLACK);
+}
+
+static CRB_REF CRB_FN(search)(const CRB_TREE* t, int value){
+    CRB_REF n = t->root;
+    while(n != CRB_NIL){
+        int v = CRB_VAL(t, n);
+        if(v == value) break;
+        n = value < v ? CRB_L(t, n) : CRB_R(t, n);
+    }
+    return n;
+}
+
+int CRB_FN(contains)(const CRB_TREE* t, int value){
+    return CRB_FN(search)(t, value) != CRB_NIL;
+}
+
+// 返回 1 插入成功，0 已存在，-1 内存不足
+int CRB_FN(insert)(CRB_TREE* t, int value){
+    CRB_REF p = CRB_NIL, n = t->root;
+    while(n != CRB_NIL){
+        int v = CRB_VAL(t, n);
+        if(v == value) return 0;
+        p = n;
+        n = value < v ? CRB_L(t, n) : CRB_R(t, n);
+    }
+
+    n = CRB_ALLOC(t);
+    if(n == CRB_NIL) return -1;
+    CRB_L(t, n) = CRB_R(t, n) = CRB_NIL;
+    CRB_PC(t, n) = CRB_PC_MAKE(p, CRB_RED);
+    CRB_VAL(t, n) = value;
+    if(p == CRB_NIL) t->root = n;
+    else if(value < CRB_VAL(t, p)) CRB_L(t, p) = n;
+    else CRB_R(t, p) = n;
+
+    CRB_FN(insert_adjust)(t, n);
+    t->size++;
+    return 1;
+}
+
+// 与 red_black_tree.c 中的 delete_node 相同，返回删除的节点数量
+int CRB_FN(delete)(CRB_TREE* t, int value){
+    CRB_REF del = CRB_FN(search)(t, value);
+    CRB_REF child, parent;
+    int delColor;
+    if(del == CRB_NIL) return 0;
+
+    if(CRB_L(t, del) != CRB_NIL && CRB_R(t, del) != CRB_NIL){
+        CRB_REF m = CRB_R(t, del);
+        while(CRB_L(t, m) != CRB_NIL) m = CRB_L(t, m);
+
+        CRB_REF mp = CRB_FN(parent)(t, m);
+        delColor = CRB_FN(color)(t, m);
+        child = CRB_R(t, m);
+        parent = mp == del ? m : mp;
+        if(child != CRB_NIL) CRB_FN(set_parent)(t, child, mp);
+        if(CRB_L(t, mp) == m) CRB_L(t, mp) = child;
+        else CRB_R(t, mp) = child;
+
+        // m 接替 del 的位置和颜色
+        CRB_REF dp = CRB_FN(parent)(t, del);
+        CRB_PC(t, m) = CRB_PC(t, del);
+        CRB_L(t, m) = CRB_L(t, del);
+        CRB_R(t, m) = CRB_R(t, del);
+        if(dp == CRB_NIL) t->root = m;
+        else if(CRB_L(t, dp) == del) CRB_L(t, dp) = m;
+        else CRB_R(t, dp) = m;
+        CRB_FN(set_parent)(t, CRB_L(t, m), m);
+        if(CRB_R(t, m) != CRB_NIL) CRB_FN(set_parent)(t, CRB_R(t, m), m);
+    } else {
+        child = CRB_L(t, del) != CRB_NIL ? CRB_L(t, del) : CRB_R(t, del);
+        parent = CRB_FN(parent)(t, del);
+        delColor = CRB_FN(color)(t, del);
+        if(child != CRB_NIL) CRB_FN(set_parent)(t, child, parent);
+        if(parent == CRB_NIL) t->root = child;
+        else if(CRB_L(t, parent) == del) CRB_L(t, parent) = child;
+        else CRB_R(t, parent) = child;
+    }
+
+    if(delColor == CRB_BLACK) CRB_FN(delete_adjust)(t, parent, child);
+    CRB_FREE(t, del);
+    t->size--;
+    return 1;
+}
+
+#undef CRB_BLACK
+#undef CRB_RED
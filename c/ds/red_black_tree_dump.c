@@ -0,0 +1,264 @@
+/*
+ * 流式导出，说明见 red_black_tree_dump.h
+ */
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include "red_black_tree_dump.h"
+
+typedef struct Out{
+    int fd;
+    char* buf;
+    size_t cap;
+    size_t len;
+    long long total;    // 已经产生的字节数，包括缓冲区模式下被丢弃的部分
+    int error;
+} Out;
+
+// 缓冲区中的内容一次 write 写出，被信号打断或者只写出一部分时继续
+static void flush_out(Out* o){
+    size_t done = 0;
+    while(done < o->len && !o->error){
+        ssize_t k = write(o->fd, o->buf + done, o->len - done);
+        if(k > 0) done += k;
+        else if(k < 0 && errno == EINTR) continue;
+        else o->error = 1;
+    }
+    o->len = 0;
+}
+
+static void put(Out* o, const char* s, size_t n){
+    o->total += n;
+    if(n <= o->cap - o->len){
+        memcpy(o->buf + o->len, s, n);
+        o->len += n;
+        return;
+    }
+    if(o->fd < 0){
+        n = o->cap - o->len;
+        if(n) memcpy(o->buf + o->len, s, n);
+        o->len += n;
+        return;
+    }
+    while(n && !o->error){
+        if(o->len == o->cap) flush_out(o);
+        size_t k = o->cap - o->len < n ? o->cap - o->len : n;
+        memcpy(o->buf + o->len, s, k);
+        o->len += k;
+        s += k;
+        n -= k;
+    }
+}
+
+static void put_str(Out* o, const char* s){
+    put(o, s, strlen(s));
+}
+
+// 重复 count 次的字符，用于缩进
+static void put_fill(Out* o, char c, size_t count){
+    char chunk[64];
+    memset(chunk, c, sizeof(chunk));
+    while(count){
+        size_t k = count < sizeof(chunk) ? count : sizeof(chunk);
+        put(o, chunk, k);
+        count -= k;
+    }
+}
+
+static char* fmt_str(char* p, const char* s){
+    while(*s) *p++ = *s++;
+    return p;
+}
+
+static char* fmt_int(char* p, int v){
+    char tmp[12];
+    int k = 0;
+    unsigned u = v < 0 ? 0u - (unsigned) v : (unsigned) v;
+    do{
+        tmp[k++] = (char)('0' + u % 10);
+        u /= 10;
+    } while(u);
+    if(v < 0) *p++ = '-';
+    while(k) *p++ = tmp[--k];
+    return p;
+}
+
+// ------------------------- 各种格式的节点输出 -------------------------
+
+// 与 visit_node 相同：middle 先输出缩进和 "-> "，之后都是 key[l/r/_r,RED/BLACK]
+static void text_node(Out* o, const TNode* n, Order order, size_t depth){
+    char line[48];
+    char* p = line;
+    if(order == middle){
+        if(depth > 1) put_fill(o, '\t', depth - 1);
+        if(depth > 0) p = fmt_str(p, "|----");
+        p = fmt_str(p, "-> ");
+    }
+    p = fmt_int(p, n->value);
+    *p++ = '[';
+    p = fmt_str(p, n->parent ? (n == n->parent->left ? "l" : "r") : "_r");
+    *p++ = ',';
+    p = fmt_str(p, n->color == RED ? "RED" : "BLACK");
+    p = fmt_str(p, "] \n");
+    put(o, line, p - line);
+}
+
+static void binary_node(Out* o, const TNode* n){
+    unsigned char rec[5];
+    unsigned v = (unsigned) n->value;
+    rec[0] = (unsigned char) v;
+    rec[1] = (unsigned char)(v >> 8);
+    rec[2] = (unsigned char)(v >> 16);
+    rec[3] = (unsigned char)(v >> 24);
+    rec[4] = (unsigned char)((n->color == RED) | (n->left ? 2 : 0) | (n->right ? 4 : 0));
+    put(o, (const char*) rec, sizeof(rec));
+}
+
+// 节点声明和连向它的边，up 为最近的导出的祖先
+static void dot_node(Out* o, const TNode* n, const TNode* up){
+    char line[96];
+    char* p = line;
+    p = fmt_str(p, "    \"");
+    p = fmt_int(p, n->value);
+    p = fmt_str(p, n->color == RED ? "\" [fillcolor=red];\n" : "\" [fillcolor=black];\n");
+    if(up){
+        p = fmt_str(p, "    \"");
+        p = fmt_int(p, up->value);
+        p = fmt_str(p, "\" -> \"");
+        p = fmt_int(p, n->value);
+        p = fmt_str(p, up == n->parent ? "\";\n" : "\" [style=dashed];\n");
+    }
+    put(o, line, p - line);
+}
+
+// ------------------------- 遍历 -------------------------
+
+typedef struct Walk{
+    Out* out;
+    const DumpOptions* opt;
+    const TNode* top;
+} Walk;
+
+static int in_range(const Walk* w, const TNode* n){
+    return !w->opt->with_range || (n->value >= w->opt->lo && n->value <= w->opt->hi);
+}
+
+// n 在 top 之下最近的导出的祖先，没有时返回空
+static const TNode* exported_ancestor(const Walk* w, const TNode* n){
+    const TNode* a = n;
+    while(a != w->top){
+        a = a->parent;
+        if(in_range(w, a)) return a;
+    }
+    return NULL;
+}
+
+enum { VISIT_PRE, VISIT_IN, VISIT_POST };
+
+static void emit(Walk* w, const TNode* n, int when, size_t depth){
+    const DumpOptions* opt = w->opt;
+    if(!in_range(w, n)) return;
+    if(opt->format == DUMP_DOT){
+        if(when == VISIT_PRE) dot_node(w->out, n, exported_ancestor(w, n));
+        return;
+    }
+    // Order 的含义与 visit_node 相同
+    int want = opt->order == middle ? VISIT_PRE : opt->order == pre ? VISIT_IN : VISIT_POST;
+    if(when != want) return;
+    if(opt->format == DUMP_TEXT) text_node(w->out, n, opt->order, depth);
+    else binary_node(w->out, n);
+}
+
+/**
+ * 借助 parent 指针非递归地遍历以 top 为根的子树，每个节点在向下经过、从左子树返回、从右子树返回时各 emit 一次，
+ * 按范围导出时不进入与 [lo, hi] 不相交的子树
+ */
+static void walk(Walk* w){
+    const DumpOptions* opt = w->opt;
+    const TNode* n = w->top;
+    size_t depth = 0;
+    int from = VISIT_PRE;
+    while(!w->out->error){
+        if(from == VISIT_PRE){
+            // 节点按插入顺序分布在内存中，先取右孩子，走完左子树回来时它大概已经在 cache 中
+            if(n->right) __builtin_prefetch(n->right);
+            emit(w, n, VISIT_PRE, depth);
+            if(n->left && (!opt->with_range || n->value > opt->lo)){
+                n = n->left;
+                ++depth;
+                continue;
+            }
+            from = VISIT_IN;
+        }
+        if(from == VISIT_IN){
+            emit(w, n, VISIT_IN, depth);
+            if(n->right && (!opt->with_range || n->value < opt->hi)){
+                n = n->right;
+                ++depth;
+                from = VISIT_PRE;
+                continue;
+            }
+        }
+        emit(w, n, VISIT_POST, depth);
+        if(n == w->top) break;
+        from = n == n->parent->left ? VISIT_IN : VISIT_POST;
+        n = n->parent;
+        --depth;
+    }
+}
+
+/**
+ * 按 opt 导出 tree（opt 为空时与 visit_tree(tree, pre) 相同）
+ * @fd    >= 0 时写入 fd，buf 作为暂存，每满一次 write 一次；< 0 时直接导出到 buf 中
+ * @return fd 模式下为写出的字节数，参数不合法或 write 出错时返回 -1；
+ *         缓冲区模式下为完整输出需要的字节数，大于 cap 表示输出被截断
+ */
+long long dump_tree(const RbTree* tree, const DumpOptions* opt, int fd, char* buf, size_t cap){
+    DumpOptions def;
+    Out o;
+    Walk w;
+    if(!opt){
+        memset(&def, 0, sizeof(def));
+        def.format = DUMP_TEXT;
+        def.order = pre;
+        opt = &def;
+    }
+    if(fd >= 0 && (!buf || !cap)) return -1;
+    if(!buf) cap = 0;
+    o.fd = fd;
+    o.buf = buf;
+    o.cap = cap;
+    o.len = 0;
+    o.total = 0;
+    o.error = 0;
+    w.out = &o;
+    w.opt = opt;
+    w.top = opt->subtree ? opt->subtree : tree ? tree->root : NULL;
+
+    if(opt->format == DUMP_BINARY){
+        unsigned char head[8] = {
+            DUMP_MAGIC & 0xff, (DUMP_MAGIC >> 8) & 0xff, (DUMP_MAGIC >> 16) & 0xff, DUMP_MAGIC >> 24,
+            DUMP_VERSION, (unsigned char) opt->order, 0, 0
+        };
+        put(&o, (const char*) head, sizeof(head));
+        if(w.top) walk(&w);
+    } else if(opt->format == DUMP_DOT){
+        put_str(&o, "digraph rbtree {\n    node [shape=circle, style=filled, fontcolor=white];\n");
+        if(w.top) walk(&w);
+        put_str(&o, "}\n");
+    } else {
+        put_str(&o, "tree: \n");
+        if(!w.top){
+            put_str(&o, "empty tree.\n");
+        } else {
+            walk(&w);
+            put_str(&o, "\n");
+        }
+    }
+
+    if(fd >= 0){
+        flush_out(&o);
+        return o.error ? -1 : o.total;
+    }
+    return o.total;
+}
@@ -0,0 +1,52 @@
+/*
+ * 流式导出
+ *
+ * visit_tree 递归遍历，每个节点一次 printf，每层缩进再各一次 printf，导出千万级节点的树非常慢，退化的输入还可能把栈用完。
+ * 这里借助 parent 指针非递归地遍历（不用栈、不申请内存），每个节点手工格式化后追加到调用方提供的缓冲区中：
+ *   fd >= 0  缓冲区只是暂存，满了之后一次 write 写出，返回写出的总字节数
+ *   fd < 0   直接导出到缓冲区中，与 snprintf 一样返回完整输出需要的字节数，超出 cap 的部分被丢弃
+ *
+ * 遍历顺序沿用 Order 在 visit_tree 中的含义：middle 为先根并带树形缩进，pre 为按 key 升序，post 为后序。
+ * 三种格式：
+ *   DUMP_TEXT    与 visit_tree 逐字节相同的文本
+ *   DUMP_BINARY  8 字节文件头（"RBTD"、版本、Order、保留），之后每个节点 5 字节：int32 key（小端）+ 标志位，
+ *                标志位 bit0 为红色，bit1/bit2 为原树中是否有左/右孩子；完整导出且 order 为 middle 时可以据此还原树的形状
+ *   DUMP_DOT     Graphviz，节点按颜色填充，忽略 order
+ * subtree 非空时只导出以它为根的子树（深度从 0 开始），with_range 时只导出 key 在 [lo, hi] 中的节点，不相交的子树直接跳过。
+ * 按范围导出 DOT 时，父节点不在范围中的节点连到最近的在范围中的祖先，以虚线表示。
+ */
+#ifndef RED_BLACK_TREE_DUMP_H
+#define RED_BLACK_TREE_DUMP_H
+
+#include <stddef.h>
+#include "red_black_tree.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define DUMP_MAGIC   0x44544252u   // "RBTD"
+#define DUMP_VERSION 1u
+
+typedef enum DumpFormat{
+    DUMP_TEXT,
+    DUMP_BINARY,
+    DUMP_DOT
+} DumpFormat;
+
+typedef struct DumpOptions{
+    DumpFormat format;
+    Order order;
+    const TNode* subtree;   // 非空时只导出这棵子树
+    int with_range;         // 非 0 时只导出 key 在 [lo, hi] 中的节点
+    int lo;
+    int hi;
+} DumpOptions;
+
+long long dump_tree(const RbTree* tree, const DumpOptions* opt, int fd, char* buf, size_t cap);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,176 @@
+/*
+ * 只读的冻结快照，说明见 red_black_tree_frozen.h
+ */
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "red_black_tree_frozen.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define FROZEN_HAVE_AVX2 1
+#endif
+
+// 批量查找时同时推进的 key 的个数
+#define FROZEN_GROUP 16
+
+static size_t go(size_t k, int i){
+    return k * (FROZEN_BLOCK + 1) + i + 1;
+}
+
+/**
+ * 按中序把有序的 key 填入隐式 B 树：先填第 i 个孩子，再填块内第 i 个 key，最后填最后一个孩子
+ * 递归深度为 log17(n)
+ */
+static void fill(FrozenTree* ft, size_t k, const TNode** cur){
+    int i;
+    if(k >= ft->nblocks) return;
+    for(i = 0; i < FROZEN_BLOCK; ++i){
+        fill(ft, go(k, i), cur);
+        if(*cur){
+            ft->blocks[k][i] = (*cur)->value;
+            *cur = next_node(*cur);
+        } else {
+            ft->blocks[k][i] = INT_MAX;
+        }
+    }
+    fill(ft, go(k, FROZEN_BLOCK), cur);
+}
+
+FrozenTree* freeze(const RbTree* tree){
+    FrozenTree* ft = (FrozenTree*) malloc(sizeof(FrozenTree));
+    if(!ft) return NULL;
+    ft->size = tree ? tree->size : 0;
+    ft->nblocks = (ft->size + FROZEN_BLOCK - 1) / FROZEN_BLOCK;
+    ft->blocks = NULL;
+    ft->max = INT_MIN;
+    ft->use_avx2 = 0;
+#ifdef FROZEN_HAVE_AVX2
+    ft->use_avx2 = __builtin_cpu_supports("avx2");
+#endif
+    if(!ft->nblocks) return ft;
+
+    ft->blocks = (int (*)[FROZEN_BLOCK]) aligned_alloc(64, ft->nblocks * sizeof(ft->blocks[0]));
+    if(!ft->blocks){
+        perror("create frozen tree error.");
+        free(ft);
+        return NULL;
+    }
+    const TNode* cur = first_node(tree);
+    fill(ft, 0, &cur);
+    ft->max = last_node(tree)->value;
+    return ft;
+}
+
+void destroy_frozen(FrozenTree* ft){
+    if(!ft) return;
+    free(ft->blocks);
+    free(ft);
+}
+
+// 块中小于 x 的 key 的个数，无分支，编译器会向量化
+static inline int rank_scalar(const int* blk, int x){
+    int i, r = 0;
+    for(i = 0; i < FROZEN_BLOCK; ++i) r += blk[i] < x;
+    return r;
+}
+
+#ifdef FROZEN_HAVE_AVX2
+__attribute__((target("avx2")))
+static inline int rank_avx2(const int* blk, int x){
+    __m256i xv = _mm256_set1_epi32(x);
+    __m256i lo = _mm256_load_si256((const __m256i*) blk);
+    __m256i hi = _mm256_load_si256((const __m256i*) (blk + 8));
+    unsigned mlo = (unsigned) _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(xv, lo)));
+    unsigned mhi = (unsigned) _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(xv, hi)));
+    return __builtin_popcount(mlo | (mhi << 8));
+}
+
+__attribute__((target("avx2")))
+static int lower_bound_avx2(const FrozenTree* ft, int x){
+    size_t k = 0;
+    int res = INT_MAX;
+    while(k < ft->nblocks){
+        int i = rank_avx2(ft->blocks[k], x);
+        if(i < FROZEN_BLOCK) res = ft->blocks[k][i];
+        k = go(k, i);
+    }
+    return res;
+}
+#endif
+
+static int lower_bound_scalar(const FrozenTree* ft, int x){
+    size_t k = 0;
+    int res = INT_MAX;
+    while(k < ft->nblocks){
+        int i = rank_scalar(ft->blocks[k], x);
+        if(i < FROZEN_BLOCK) res = ft->blocks[k][i];
+        k = go(k, i);
+    }
+    return res;
+}
+
+/**
+ * 第一个 >= value 的 key，与 lower_bound 语义相同
+ * 填充位都是 INT_MAX，只要 value <= max，真实存在的 key 一定比填充位先被选中
+ * @return 1 找到，结果写入 out；0 不存在
+ */
+int frozen_lower_bound(const FrozenTree* ft, int value, int* out){
+    if(!ft || !ft->size || value > ft->max) return 0;
+#ifdef FROZEN_HAVE_AVX2
+    if(ft->use_avx2){
+        *out = lower_bound_avx2(ft, value);
+        return 1;
+    }
+#endif
+    *out = lower_bound_scalar(ft, value);
+    return 1;
+}
+
+int frozen_search(const FrozenTree* ft, int value){
+    int r;
+    return frozen_lower_bound(ft, value, &r) && r == value;
+}
+
+/**
+ * 批量 lower_bound：每组 FROZEN_GROUP 个 key 逐层同步推进，
+ * 每算出一个 key 下一层的块就立即预取，等这一组都推进一层后再回来处理，这时块多半已经在 cache 中了
+ */
+void frozen_lower_bound_many(const FrozenTree* ft, const int* values, size_t n, int* out, unsigned char* found){
+    size_t base, j;
+    for(base = 0; base < n; base += FROZEN_GROUP){
+        size_t g = n - base < FROZEN_GROUP ? n - base : FROZEN_GROUP;
+        size_t k[FROZEN_GROUP];
+        int res[FROZEN_GROUP];
+        size_t active = 0;
+        for(j = 0; j < g; ++j){
+            k[j] = 0;
+            res[j] = INT_MAX;
+            found[base + j] = ft->size && values[base + j] <= ft->max;
+            if(found[base + j]) active++;
+            else k[j] = ft->nblocks;
+        }
+
+        while(active){
+            active = 0;
+            for(j = 0; j < g; ++j){
+                if(k[j] >= ft->nblocks) continue;
+                const int* blk = ft->blocks[k[j]];
+                int i;
+#ifdef FROZEN_HAVE_AVX2
+                if(ft->use_avx2) i = rank_avx2(blk, values[base + j]);
+                else
+#endif
+                i = rank_scalar(blk, values[base + j]);
+                if(i < FROZEN_BLOCK) res[j] = blk[i];
+                k[j] = go(k[j], i);
+                if(k[j] < ft->nblocks){
+                    __builtin_prefetch(ft->blocks[k[j]]);
+                    active++;
+                }
+            }
+        }
+
+        for(j = 0; j < g; ++j) out[base + j] = res[j];
+    }
+}
@@ -0,0 +1,328 @@
+/*
+ * 按类型特化的红黑树，通过宏在编译期生成
+ *
+ * red_black_tree.c 中的 TNode 只能保存 int，如果换成 void* + compare 函数指针，
+ * 每次比较都是一次间接调用，查找时无法内联。这里用宏为每种 key/value 类型单独生成一份代码，
+ * key 和 value 直接内嵌在节点里，比较函数是 static inline 的，编译器可以直接内联。
+ *
+ * 用法：
+ *   typedef struct { char data[16]; } Payload;
+ *   RB_GENERATE(u64map, uint64_t, Payload, rb_cmp_u64)
+ *
+ *   u64map m;
+ *   u64map_init(&m);
+ *   uint64_t k = 42; Payload v = {{0}};
+ *   u64map_insert(&m, &k, &v);
+ *   Payload* p = u64map_get(&m, &k);
+ *   u64map_delete(&m, &k);
+ *   u64map_destroy(&m);
+ *
+ * 比较函数的签名为 int cmp(const KeyT* a, const KeyT* b)，返回值 <0、0、>0，
+ * 可以是 static inline 函数，也可以是宏。
+ */
+#ifndef RED_BLACK_TREE_GEN_H
+#define RED_BLACK_TREE_GEN_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define RB_GEN_BLACK 0
+#define RB_GEN_RED   1
+
+static inline int rb_cmp_u64(const uint64_t* a, const uint64_t* b){
+    return (*a > *b) - (*a < *b);
+}
+
+static inline int rb_cmp_int(const int* a, const int* b){
+    return (*a > *b) - (*a < *b);
+}
+
+/**
+ * 定长的内嵌字符串 key，字符串直接存放在节点中，比较时不需要再跳转一次指针
+ * RB_INLINE_STR(RbStr32, 32) 定义类型 RbStr32 以及比较函数 RbStr32_cmp、赋值函数 RbStr32_set
+ * s 总是以 '\0' 结尾，最多保存 N-1 个字符。_set 遇到更长的字符串时截断并返回 -1，
+ * 截断后前 N-1 个字符相同的 key 会被当成同一个 key，调用方应当拒绝这样的 key，否则 _upsert 会覆盖别的 key
+ */
+#define RB_INLINE_STR(type, N)                                                  \
+typedef struct type { char s[N]; } type;                                        \
+static inline int type##_cmp(const type* a, const type* b){                     \
+    return strncmp(a->s, b->s, N);                                              \
+}                                                                               \
+static inline int type##_set(type* k, const char* str){                         \
+    const char* end = (const char*) memchr(str, '\0', N);                       \
+    if(end){                                                                    \
+        memcpy(k->s, str, end - str + 1);                                       \
+        return 0;                                                               \
+    }                                                                           \
+    memcpy(k->s, str, N - 1);                                                   \
+    k->s[N - 1] = '\0';                                                         \
+    return -1;                                                                  \
+}
+
+/**
+ * 生成名为 name 的树类型 name 和节点类型 name##_node，以及以下函数：
+ *   name##_init / name##_destroy
+ *   name##_search / name##_get
+ *   name##_insert / name##_delete
+ *   name##_find_or_insert / name##_upsert
+ * 算法与 red_black_tree.c 中的 insert_adjust / delete_adjust 一致
+ */
+#define RB_GENERATE(name, KeyT, ValT, CMP)                                      \
+typedef struct name##_node{                                                     \
+    struct name##_node* left;                                                   \
+    struct name##_node* right;                                                  \
+    struct name##_node* parent;                                                 \
+    int color;                                                                  \
+    KeyT key;                                                                   \
+    ValT value;                                                                 \
+} name##_node;                                                                  \
+                                                                                \
+typedef struct name{                                                            \
+    name##_node* root;                                                          \
+    size_t size;                                                                \
+} name;                                                                         \
+                                                                                \
+static inline void name##_init(name* t){                                        \
+    t->root = NULL;                                                             \
+    t->size = 0;                                                                \
+}                                                                               \
+                                                                                \
+static inline name##_node* name##_search(const name* t, const KeyT* key){       \
+    name##_node* n = t->root;                                                   \
+    while(n){                                                                   \
+        int c = CMP(key, &n->key);                                              \
+        if(c == 0) return n;                                                    \
+        n = c < 0 ? n->left : n->right;                                         \
+    }                                                                           \
+    return NULL;                                                                \
+}                                                                               \
+                                                                                \
+static inline ValT* name##_get(const name* t, const KeyT* key){                 \
+    name##_node* n = name##_search(t, key);                                     \
+    return n ? &n->value : NULL;                                                \
+}                                                                               \
+                                                                                \
+static inline void name##_left_rotate(name* t, name##_node* node){              \
+    name##_node* pNode = node->parent;                                          \
+    name##_node* rNode = node->right;                                           \
+    if(!pNode) t->root = rNode;                                                 \
+    else if(node == pNode->left) pNode->left = rNode;                           \
+    else pNode->right = rNode;                                                  \
+    rNode->parent = pNode;                                                      \
+    node->right = rNode->left;                                                  \
+    if(rNode->left) rNode->left->parent = node;                                 \
+    rNode->left = node;                                                         \
+    node->parent = rNode;                                                       \
+}                                                                               \
+                                                                                \
+static inline void name##_right_rotate(name* t, name##_node* node){             \
+    name##_node* pNode = node->parent;                                          \
+    name##_node* lNode = node->left;                                            \
+    if(!pNode) t->root = lNode;                                                 \
+    else if(node == pNode->right) pNode->right = lNode;                         \
+    else pNode->left = lNode;                                                   \
+    lNode->parent = pNode;                                                      \
+    node->left = lNode->right;                                                  \
+    if(lNode->right) lNode->right->parent = node;                               \
+    lNode->right = node;                                                        \
+    node->parent = lNode;                                                       \
+}                                                                               \
+                                                                                \
+static inline void name##_insert_adjust(name* t, name##_node* node){            \
+    while(node->parent && node->parent->color == RB_GEN_RED){                   \
+        name##_node* p = node->parent;                                          \
+        name##_node* g = p->parent;                                             \
+        name##_node* u = (p == g->left) ? g->right : g->left;                   \
+        if(u && u->color == RB_GEN_RED){                                        \
+            g->color = RB_GEN_RED;                                              \
+            p->color = RB_GEN_BLACK;                                            \
+            u->color = RB_GEN_BLACK;                                            \
+            node = g;                                                           \
+            continue;                                                           \
+        }                                                                       \
+        if(node == p->right && p == g->left){                                   \
+            name##_left_rotate(t, p);                                           \
+            node = node->left;                                                  \
+        } else if(node == p->left && p == g->right){                            \
+            name##_right_rotate(t, p);                                          \
+            node = node->right;                                                 \
+        }                                                                       \
+        node->parent->color = RB_GEN_BLACK;                                     \
+        g->color = RB_GEN_RED;                                                  \
+        if(node == node->parent->right) name##_left_rotate(t, g);               \
+        else name##_right_rotate(t, g);                                         \
+        break;                                                                  \
+    }                                                                           \
+    t->root->color = RB_GEN_BLACK;                                              \
+}                                                                               \
+                                                                                \
+/* 查找 key，不存在时以 *value 插入，只查找一遍，只有插入时才申请节点；         \
+ * *inserted 为 1 表示新插入，返回 key 所在的节点，内存不足时返回 NULL */       \
+static inline name##_node* name##_find_or_insert(name* t, const KeyT* key,      \
+                                                 const ValT* value,             \
+                                                 int* inserted){                \
+    name##_node *p = NULL, *n = t->root;                                        \
+    int c = 0;                                                                  \
+    *inserted = 0;                                                              \
+    while(n){                                                                   \
+        c = CMP(key, &n->key);                                                  \
+        if(c == 0) return n;                                                    \
+        p = n;                                                                  \
+        n = c < 0 ? n->left : n->right;                                         \
+    }                                                                           \
+    n = (name##_node*) malloc(sizeof(name##_node));                             \
+    if(!n) return NULL;                                                         \
+    n->key = *key;                                                              \
+    n->value = *value;                                                          \
+    n->color = RB_GEN_RED;                                                      \
+    n->left = n->right = NULL;                                                  \
+    n->parent = p;                                                              \
+    if(!p) t->root = n;                                                         \
+    else if(c < 0) p->left = n;                                                 \
+    else p->right = n;                                                          \
+    name##_insert_adjust(t, n);                                                 \
+    t->size++;                                                                  \
+    *inserted = 1;                                                              \
+    return n;                                                                   \
+}                                                                               \
+                                                                                \
+/* 返回 1 表示插入成功，0 表示 key 已存在（不会覆盖 value），-1 表示内存不足 */        \
+static inline int name##_insert(name* t, const KeyT* key, const ValT* value){   \
+    int inserted;                                                               \
+    if(!name##_find_or_insert(t, key, value, &inserted)) return -1;             \
+    return inserted;                                                            \
+}                                                                               \
+                                                                                \
+/* 插入或覆盖 value，返回 1 表示插入，0 表示覆盖，-1 表示内存不足 */            \
+static inline int name##_upsert(name* t, const KeyT* key, const ValT* value){   \
+    int inserted;                                                               \
+    name##_node* n = name##_find_or_insert(t, key, value, &inserted);           \
+    if(!n) return -1;                                                           \
+    if(!inserted) n->value = *value;                                            \
+    return inserted;                                                            \
+}                                                                               \
+                                                                                \
+static inline void name##_delete_adjust(name* t, name##_node* parent,           \
+                                        name##_node* child){                    \
+    name##_node* brother;                                                       \
+    while((!child || child->color == RB_GEN_BLACK) && child != t->root){        \
+        if(child == parent->left){                                              \
+            brother = parent->right;                                            \
+            if(brother->color == RB_GEN_RED){                                   \
+                brother->color = RB_GEN_BLACK;                                  \
+                parent->color = RB_GEN_RED;                                     \
+                name##_left_rotate(t, parent);                                  \
+                brother = parent->right;                                        \
+            }                                                                   \
+            if((!brother->left || brother->left->color == RB_GEN_BLACK) &&      \
+               (!brother->right || brother->right->color == RB_GEN_BLACK)){     \
+                brother->color = RB_GEN_RED;                                    \
+                child = parent;                                                 \
+                parent = parent->parent;                                        \
+            } else {                                                            \
+                if(!brother->right || brother->right->color == RB_GEN_BLACK){   \
+                    if(brother->left) brother->left->color = RB_GEN_BLACK;      \
+                    brother->color = RB_GEN_RED;                                \
+                    name##_right_rotate(t, brother);                            \
+                    brother = parent->right;                                    \
+                }                                                               \
+                brother->color = parent->color;                                 \
+                parent->color = RB_GEN_BLACK;                                   \
+                if(brother->right) brother->right->color = RB_GEN_BLACK;        \
+                name##_left_rotate(t, parent);                                  \
+                child = t->root;                                                \
+                break;                                                          \
+            }                                                                   \
+        } else {                                                                \
+            brother = parent->left;                                             \
+            if(brother->color == RB_GEN_RED){                                   \
+                brother->color = RB_GEN_BLACK;                                  \
+                parent->color = RB_GEN_RED;                                     \
+                name##_right_rotate(t, parent);                                 \
+                brother = parent->left;                                         \
+            }                                                                   \
+            if((!brother->right || brother->right->color == RB_GEN_BLACK) &&    \
+               (!brother->left || brother->left->color == RB_GEN_BLACK)){       \
+                brother->color = RB_GEN_RED;                                    \
+                child = parent;                                                 \
+                parent = parent->parent;                                        \
+            } else {                                                            \
+                if(!brother->left || brother->left->color == RB_GEN_BLACK){     \
+                    if(brother->right) brother->right->color = RB_GEN_BLACK;    \
+                    brother->color = RB_GEN_RED;                                \
+                    name##_left_rotate(t, brother);                             \
+                    brother = parent->left;                                     \
+                }                                                               \
+                brother->color = parent->color;                                 \
+                parent->color = RB_GEN_BLACK;                                   \
+                if(brother->left) brother->left->color = RB_GEN_BLACK;          \
+                name##_right_rotate(t, parent);                                 \
+                child = t->root;                                                \
+                break;                                                          \
+            }                                                                   \
+        }                                                                       \
+    }                                                                           \
+    if(child) child->color = RB_GEN_BLACK;                                      \
+}                                                                               \
+                                                                                \
+/* 返回删除的节点数量 */                                                           \
+static inline int name##_delete(name* t, const KeyT* key){                      \
+    name##_node* del = name##_search(t, key);                                   \
+    name##_node *child, *parent;                                                \
+    int delColor;                                                               \
+    if(!del) return 0;                                                          \
+    if(del->left && del->right){                                                \
+        name##_node* m = del->right;                                            \
+        while(m->left) m = m->left;                                             \
+        delColor = m->color;                                                    \
+        child = m->right;                                                       \
+        parent = m->parent == del ? m : m->parent;                              \
+        if(child) child->parent = m->parent;                                    \
+        if(m->parent->left == m) m->parent->left = child;                       \
+        else m->parent->right = child;                                          \
+        m->parent = del->parent;                                                \
+        m->left = del->left;                                                    \
+        m->right = del->right;                                                  \
+        m->color = del->color;                                                  \
+        if(!del->parent) t->root = m;                                           \
+        else if(del->parent->left == del) del->parent->left = m;                \
+        else del->parent->right = m;                                            \
+        del->left->parent = m;                                                  \
+        if(del->right) del->right->parent = m;                                  \
+    } else {                                                                    \
+        child = del->left ? del->left : del->right;                             \
+        parent = del->parent;                                                   \
+        delColor = del->color;                                                  \
+        if(child) child->parent = parent;                                       \
+        if(!parent) t->root = child;                                            \
+        else if(del == parent->left) parent->left = child;                      \
+        else parent->right = child;                                             \
+    }                                                                           \
+    if(delColor == RB_GEN_BLACK) name##_delete_adjust(t, parent, child);        \
+    free(del);                                                                  \
+    t->size--;                                                                  \
+    return 1;                                                                   \
+}                                                                               \
+                                                                                \
+/* 非递归后序释放所有节点 */                                                        \
+static inline void name##_destroy(name* t){                                     \
+    name##_node* n = t->root;                                                   \
+    while(n){                                                                   \
+        if(n->left) n = n->left;                                                \
+        else if(n->right) n = n->right;                                         \
+        else {                                                                  \
+            name##_node* p = n->parent;                                         \
+            if(p){                                                              \
+                if(p->left == n) p->left = NULL;                                \
+                else p->right = NULL;                                           \
+            }                                                                   \
+            free(n);                                                            \
+            n = p;                                                              \
+        }                                                                       \
+    }                                                                           \
+    t->root = NULL;                                                             \
+    t->size = 0;                                                                \
+}
+
+#endif
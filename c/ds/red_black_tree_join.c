@@ -0,0 +1,646 @@
+/*
+ * 基于 join/split 的集合运算，说明见 red_black_tree_join.h
+ */
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "red_black_tree_join.h"
+
+// 一棵独立的子树：root 的 parent 为空并且是黑色，bh 为黑高（空树为 0）
+typedef struct Sub{
+    TNode* root;
+    int bh;
+} Sub;
+
+static const Sub empty_sub = { NULL, 0 };
+
+// 把 node 从父节点上摘下来作为独立的子树，h 为它在原来位置上的黑高；红色的根改成黑色，黑高加一
+static Sub detach(TNode* node, int h){
+    Sub s = { node, h };
+    if(!node) return empty_sub;
+    node->parent = NULL;
+    if(node->color == RED){
+        node->color = BLACK;
+        s.bh++;
+    }
+    return s;
+}
+
+// 整棵树作为一棵独立的子树，沿左边缘数出黑高
+static Sub whole(const RbTree* tree){
+    Sub s = { tree->root, 0 };
+    const TNode* n;
+    for(n = tree->root; n; n = n->left) s.bh += n->color == BLACK;
+    return s;
+}
+
+/**
+ * 与 insert_adjust 相同的修复，用循环代替递归
+ * @return 改色一直传到根节点、根由红变黑时返回 1，表示整棵树的黑高加一
+ */
+static int join_fixup(RbTree* tree, TNode* node){
+    while(1){
+        TNode* p = node->parent;
+        if(!p){
+            if(node->color == BLACK) return 0;
+            node->color = BLACK;
+            return 1;
+        }
+        if(p->color == BLACK) return 0;
+
+        // p 为红色，一定不是根，祖父 g 为黑色
+        TNode* g = p->parent;
+        TNode* u = p == g->left ? g->right : g->left;
+        if(u && u->color == RED){
+            g->color = RED;
+            p->color = BLACK;
+            u->color = BLACK;
+            node = g;
+            continue;
+        }
+        if(node == p->right && p == g->left){
+            left_rotate(tree, p);
+            p = node;
+        } else if(node == p->left && p == g->right){
+            right_rotate(tree, p);
+            p = node;
+        }
+        p->color = BLACK;
+        g->color = RED;
+        if(p == g->left) right_rotate(tree, g);
+        else left_rotate(tree, g);
+        return 0;
+    }
+}
+
+/**
+ * 拼接 l、k、r，要求 l 中的 key 都小于 k->value，r 中的都大于 k->value
+ * 黑高相同时 k 直接作为黑色的根；否则沿较高的一棵的右（左）边缘向下，找到黑高与较矮的一棵相同的黑色节点 c，
+ * 以红色的 k 代替 c 的位置，c 和较矮的树作为 k 的两个孩子，再向上修复连续的红色
+ * tree 只提供附加信息的维护方式，旋转到根时写的是它的一份局部拷贝，不同线程可以同时对不相交的子树调用
+ */
+static Sub join_sub(const RbTree* tree, Sub l, TNode* k, Sub r){
+    Sub out;
+    k->parent = NULL;
+    if(l.bh == r.bh){
+        k->left = l.root;
+        k->right = r.root;
+        k->color = BLACK;
+        if(l.root) l.root->parent = k;
+        if(r.root) r.root->parent = k;
+        if(tree->augment) tree->augment->update(k);
+        out.root = k;
+        out.bh = l.bh + 1;
+        return out;
+    }
+
+    int right = l.bh > r.bh;
+    Sub big = right ? l : r, small = right ? r : l;
+    TNode *p = NULL, *c = big.root;
+    int h = big.bh;
+    while(c && !(c->color == BLACK && h == small.bh)){
+        h -= c->color == BLACK;
+        p = c;
+        c = right ? c->right : c->left;
+    }
+
+    // big 的根是黑色且黑高更大，p 一定不为空
+    k->color = RED;
+    k->parent = p;
+    if(right){
+        p->right = k;
+        k->left = c;
+        k->right = small.root;
+    } else {
+        p->left = k;
+        k->left = small.root;
+        k->right = c;
+    }
+    if(c) c->parent = k;
+    if(small.root) small.root->parent = k;
+
+    RbTree local = *tree;
+    local.root = big.root;
+    augment_propagate(&local, k);
+    out.bh = big.bh + join_fixup(&local, k);
+    out.root = local.root;
+    return out;
+}
+
+/**
+ * 按 k 把 t 拆成小于 k 的 *l 和大于 k 的 *r，沿查找路径递归，路径上的节点依次 join 回对应的一侧
+ * 等于 k 的节点（如果有）被摘下来放在 *found 中，否则 *found 为空
+ */
+static void split_sub(const RbTree* tree, Sub t, int k, Sub* l, Sub* r, TNode** found){
+    TNode* n = t.root;
+    Sub mid;
+    if(!n){
+        *l = *r = empty_sub;
+        *found = NULL;
+        return;
+    }
+
+    Sub left = detach(n->left, t.bh - 1), right = detach(n->right, t.bh - 1);
+    if(k == n->value){
+        *l = left;
+        *r = right;
+        n->left = n->right = NULL;
+        *found = n;
+    } else if(k < n->value){
+        split_sub(tree, left, k, l, &mid, found);
+        *r = join_sub(tree, mid, n, right);
+    } else {
+        split_sub(tree, right, k, &mid, r, found);
+        *l = join_sub(tree, left, n, mid);
+    }
+}
+
+// 摘下 t 中最大的节点，剩下的部分放在 *rest 中
+static TNode* split_last(const RbTree* tree, Sub t, Sub* rest){
+    TNode* n = t.root;
+    Sub left = detach(n->left, t.bh - 1), sub;
+    if(!n->right){
+        n->left = NULL;
+        *rest = left;
+        return n;
+    }
+    TNode* last = split_last(tree, detach(n->right, t.bh - 1), &sub);
+    *rest = join_sub(tree, left, n, sub);
+    return last;
+}
+
+// 没有中间节点的拼接：摘下 l 的最大节点作为中间节点
+static Sub join2(const RbTree* tree, Sub l, Sub r){
+    Sub rest;
+    if(!l.root) return r;
+    if(!r.root) return l;
+    TNode* last = split_last(tree, l, &rest);
+    return join_sub(tree, rest, last, r);
+}
+
+// ------------------------- 节点回收与归属 -------------------------
+
+// 借助 parent 指针非递归地后序释放以 root 为根的子树，返回释放的节点数
+static size_t free_subtree(RbTree* tree, TNode* root){
+    TNode* n = root;
+    size_t count = 0;
+    if(!root) return 0;
+    root->parent = NULL;
+    while(n){
+        if(n->left){
+            n = n->left;
+        } else if(n->right){
+            n = n->right;
+        } else {
+            TNode* p = n->parent;
+            if(p){
+                if(p->left == n) p->left = NULL;
+                else p->right = NULL;
+            }
+            free_node(tree, n);
+            ++count;
+            n = p;
+        }
+    }
+    return count;
+}
+
+// 分叉执行期间需要回收的子树，通过根节点的 parent 串起来，集合运算结束后在调用线程中统一释放（分配器不是线程安全的）
+typedef struct Drop{
+    TNode* head;
+    TNode* tail;
+} Drop;
+
+static void drop_concat(Drop* d, const Drop* other){
+    if(!other->head) return;
+    if(d->tail) d->tail->parent = other->head;
+    else d->head = other->head;
+    d->tail = other->tail;
+}
+
+static void free_dropped(RbTree* tree, Drop* d){
+    TNode* e = d->head;
+    while(e){
+        TNode* next = e->parent;
+        free_subtree(tree, e);
+        e = next;
+    }
+    d->head = d->tail = NULL;
+}
+
+// 复制以 n 为根的子树到 dst 的分配器中，内存不足时置 *oom，已经复制的部分照常挂在返回的子树上
+static TNode* copy_sub(RbTree* dst, const TNode* n, TNode* parent, int* oom){
+    if(!n || *oom) return NULL;
+    TNode* c = alloc_node(dst, n->value);
+    if(!c){
+        *oom = 1;
+        return NULL;
+    }
+    *c = *n;
+    c->parent = parent;
+    c->left = copy_sub(dst, n->left, c, oom);
+    c->right = copy_sub(dst, n->right, c, oom);
+    return c;
+}
+
+/**
+ * 取出 src 的全部节点作为一棵独立的子树，src 被清空
+ * 与 dst 不共用分配器时先把节点复制到 dst 的分配器中，再释放原来的节点；附加信息的维护方式不同时，取出的节点按 dst 的重新计算
+ * @return 0 成功，-1 内存不足（src 不变）
+ */
+static int take_all(RbTree* dst, RbTree* src, Sub* out){
+    // 节点要在两棵树之间移动，放弃进行中的 relayout_step
+    relayout_cancel(dst);
+    relayout_cancel(src);
+    rebalance_all(src);
+    *out = whole(src);
+    if(src->root && src->allocator != dst->allocator){
+        int oom = 0;
+        TNode* copy = copy_sub(dst, src->root, NULL, &oom);
+        if(oom){
+            free_subtree(dst, copy);
+            return -1;
+        }
+        free_subtree(src, src->root);
+        out->root = copy;
+    }
+    if(out->root && src->augment != dst->augment){
+        // 只重新计算取出的节点，src 自己的维护方式不变
+        RbTree local = *dst;
+        local.root = out->root;
+        set_augment(&local, dst->augment);
+    }
+    src->root = NULL;
+    src->size = 0;
+    src->leftmost = src->rightmost = NULL;
+    return 0;
+}
+
+// 独立子树的节点个数：维护 size_augment 时直接读根节点，否则数一遍
+static size_t sub_size(const RbTree* tree, TNode* root){
+    size_t n = 0;
+    if(!root) return 0;
+    if(tree->augment == &size_augment) return root->aug.size;
+    while(root->left) root = root->left;
+    for(; root; root = next_node(root)) ++n;
+    return n;
+}
+
+static void set_root(RbTree* tree, Sub s, size_t size){
+    relayout_cancel(tree);
+    tree->root = s.root;
+    tree->size = size;
+    tree->leftmost = first_node(tree);
+    tree->rightmost = last_node(tree);
+}
+
+// ------------------------- 对外接口 -------------------------
+
+/**
+ * 把 k 和 t2 拼接到 t1 的右边，要求 t1 中的 key 都小于 k，t2 中的都大于 k，t2 被清空
+ * @return 1 成功，0 key 的顺序不满足要求（两棵树都不变），-1 内存不足
+ */
+int tree_join(RbTree* t1, int k, RbTree* t2){
+    Sub r;
+    if(!t1 || !t2 || t1 == t2) return 0;
+    if(t1->rightmost && t1->rightmost->value >= k) return 0;
+    if(t2->root && first_node(t2)->value <= k) return 0;
+
+    TNode* node = alloc_node(t1, k);
+    if(!node) return -1;
+    size_t size = t1->size + 1 + t2->size;
+    rebalance_all(t1);
+    if(take_all(t1, t2, &r) != 0){
+        free_node(t1, node);
+        return -1;
+    }
+    set_root(t1, join_sub(t1, whole(t1), node, r), size);
+    return 1;
+}
+
+/**
+ * 把 tree 中 >= k 的 key 分到一棵新树（与 tree 共用分配器）中返回，tree 中留下 < k 的 key
+ * @return 新树，内存不足时返回 NULL（tree 不变）
+ */
+RbTree* tree_split(RbTree* tree, int k){
+    Sub l, r;
+    TNode* found;
+    if(!tree) return NULL;
+    RbTree* right = new_tree_sharing(tree);
+    if(!right) return NULL;
+
+    rebalance_all(tree);
+    split_sub(tree, whole(tree), k, &l, &r, &found);
+    if(found) r = join_sub(tree, empty_sub, found, r);
+    size_t n = sub_size(tree, r.root);
+    set_root(tree, l, tree->size - n);
+    set_root(right, r, n);
+    return right;
+}
+
+/**
+ * 把 [lo, hi] 中的 key 分到一棵新树（与 tree 共用分配器）中返回：split 两次，中间部分取出，两边 join2 回去
+ * @return 新树，内存不足时返回 NULL（tree 不变）
+ */
+RbTree* tree_extract_range(RbTree* tree, int lo, int hi){
+    Sub a, b, c, d;
+    TNode *f1, *f2;
+    if(!tree) return NULL;
+    RbTree* out = new_tree_sharing(tree);
+    if(!out || lo > hi) return out;
+
+    rebalance_all(tree);
+    split_sub(tree, whole(tree), lo, &a, &b, &f1);
+    split_sub(tree, b, hi, &c, &d, &f2);
+    if(f1) c = join_sub(tree, empty_sub, f1, c);
+    if(f2) c = join_sub(tree, c, f2, empty_sub);
+    size_t n = sub_size(tree, c.root);
+    set_root(tree, join2(tree, a, d), tree->size - n);
+    set_root(out, c, n);
+    return out;
+}
+
+/**
+ * 删除 [lo, hi] 中的所有 key，O(log n + 删除的个数)，中间部分在释放的同时计数
+ * @return 删除的个数
+ */
+size_t tree_delete_range(RbTree* tree, int lo, int hi){
+    Sub a, b, c, d;
+    TNode *f1, *f2;
+    if(!tree || lo > hi) return 0;
+
+    rebalance_all(tree);
+    split_sub(tree, whole(tree), lo, &a, &b, &f1);
+    split_sub(tree, b, hi, &c, &d, &f2);
+    size_t n = free_subtree(tree, c.root);
+    if(f1){
+        free_node(tree, f1);
+        ++n;
+    }
+    if(f2){
+        free_node(tree, f2);
+        ++n;
+    }
+    set_root(tree, join2(tree, a, d), tree->size - n);
+    return n;
+}
+
+// ------------------------- 集合运算 -------------------------
+
+enum { SET_UNION, SET_INTERSECTION, SET_DIFFERENCE };
+
+typedef struct SetTask{
+    RbTree* tree;
+    int op;
+    Sub a, b;
+    int depth;        // 还可以分叉的层数
+    int concurrent;   // 是否可能有其他线程在同时运行，是的话丢弃的节点先记在 drop 中，否则立即释放（节点还在 cache 中）
+    Sub out;
+    Drop drop;
+    size_t common;    // a、b 中都有的 key 的个数
+} SetTask;
+
+static void drop_sub(SetTask* t, TNode* root){
+    if(!root) return;
+    if(!t->concurrent){
+        free_subtree(t->tree, root);
+        return;
+    }
+    root->parent = NULL;
+    if(t->drop.tail) t->drop.tail->parent = root;
+    else t->drop.head = root;
+    t->drop.tail = root;
+}
+
+static void drop_node(SetTask* t, TNode* node){
+    node->left = node->right = NULL;
+    drop_sub(t, node);
+}
+
+/**
+ * 并集中 b 只有一个节点时直接插入 a：向下查找，重复时丢弃，否则作为红色叶子挂上去再修复，
+ * 查找路径上只有读，比 split 再 join 少改写 O(log n) 个节点
+ */
+static Sub union_insert(SetTask* t, Sub a, TNode* node){
+    TNode *p = NULL, *x = a.root;
+    while(x){
+        if(x->value == node->value){
+            t->common++;
+            drop_node(t, node);
+            return a;
+        }
+        p = x;
+        x = node->value < x->value ? x->left : x->right;
+    }
+    node->color = RED;
+    node->parent = p;
+    if(node->value < p->value) p->left = node;
+    else p->right = node;
+
+    RbTree local = *t->tree;
+    local.root = a.root;
+    augment_propagate(&local, node);
+    a.bh += join_fixup(&local, node);
+    a.root = local.root;
+    return a;
+}
+
+static int op_threads;   // 0 表示按在线的 CPU 个数
+
+/**
+ * 集合运算最多使用的线程数，0 表示按在线的 CPU 个数，1 表示不分叉
+ */
+void set_op_threads(int threads){
+    op_threads = threads;
+}
+
+// 递归的前 ceil(log2(threads)) 层分叉
+static int fork_depth(){
+    int threads = op_threads > 0 ? op_threads : (int) sysconf(_SC_NPROCESSORS_ONLN);
+    int d = 0;
+    while((1 << d) < threads) ++d;
+    return d;
+}
+
+static void set_op(SetTask* t);
+
+static void* set_op_thread(void* arg){
+    set_op((SetTask*) arg);
+    return NULL;
+}
+
+/**
+ * 以 a 的根 n 为界 split b，两侧分别递归，最后按运算决定 n 是否保留：
+ * 保留时 join(左, n, 右)，不保留时 join2(左, 右)；b 中与 n 相同的节点总是被丢弃
+ */
+static void set_op(SetTask* t){
+    Sub a = t->a, b = t->b;
+    if(!a.root || !b.root){
+        if(t->op == SET_UNION){
+            t->out = a.root ? a : b;
+        } else if(t->op == SET_DIFFERENCE){
+            t->out = a;
+            drop_sub(t, b.root);
+        } else {
+            t->out = empty_sub;
+            drop_sub(t, a.root);
+            drop_sub(t, b.root);
+        }
+        return;
+    }
+    if(t->op == SET_UNION && !b.root->left && !b.root->right){
+        t->out = union_insert(t, a, b.root);
+        return;
+    }
+
+    TNode* n = a.root;
+    TNode* found;
+    SetTask left, right;
+    left.tree = right.tree = t->tree;
+    left.op = right.op = t->op;
+    left.depth = right.depth = t->depth - 1;
+    int fork = t->depth > 0 && a.bh >= SET_PAR_MIN_BH;
+    left.concurrent = right.concurrent = t->concurrent || fork;
+    left.drop.head = left.drop.tail = NULL;
+    right.drop = left.drop;
+    left.common = right.common = 0;
+    left.a = detach(n->left, a.bh - 1);
+    right.a = detach(n->right, a.bh - 1);
+    split_sub(t->tree, b, n->value, &left.b, &right.b, &found);
+
+    pthread_t th;
+    int forked = fork && pthread_create(&th, NULL, set_op_thread, &left) == 0;
+    if(!forked) set_op(&left);
+    set_op(&right);
+    if(forked) pthread_join(th, NULL);
+
+    t->common += left.common + right.common + (found != NULL);
+    drop_concat(&t->drop, &left.drop);
+    drop_concat(&t->drop, &right.drop);
+    if(found) drop_node(t, found);
+
+    int keep = t->op == SET_UNION || (t->op == SET_INTERSECTION) == (found != NULL);
+    if(keep){
+        t->out = join_sub(t->tree, left.out, n, right.out);
+    } else {
+        drop_node(t, n);
+        t->out = join2(t->tree, left.out, right.out);
+    }
+}
+
+// ------------------------- 逐个元素的集合运算 -------------------------
+
+/**
+ * 逐个拆下以 *cur 为根的独立子树中的节点：每次向下走到一个叶子，从父节点上摘下来返回，拆完返回 NULL
+ * 从上一个叶子的父节点继续，每条边只向下走一次，拆下的节点 left、right、parent 都为空
+ */
+static TNode* next_leaf(TNode** cur){
+    TNode* n = *cur;
+    if(!n) return NULL;
+    while(n->left || n->right) n = n->left ? n->left : n->right;
+    TNode* p = n->parent;
+    if(p){
+        if(p->left == n) p->left = NULL;
+        else p->right = NULL;
+    }
+    n->parent = NULL;
+    *cur = p;
+    return n;
+}
+
+// 把拆下来的节点重新插入 tree，已经存在时释放
+static void reinsert(RbTree* tree, TNode* n){
+    n->color = RED;
+    if(tree->augment) tree->augment->update(n);
+    if(!insert_node(tree, n)) free_node(tree, n);
+}
+
+// 释放 tree 的全部节点，tree 本身仍然有效
+static void clear_all(RbTree* tree){
+    rebalance_all(tree);
+    free_subtree(tree, tree->root);
+    set_root(tree, empty_sub, 0);
+}
+
+/**
+ * 较小的一侧只有 m 个 key、远小于另一侧的 n 个时，逐个查找、插入或删除这 m 个 key，O(m log n)：
+ * split/join 的递归虽然也是 O(m log(n/m + 1))，但每一层都要拆开、拼回路径上的节点，常数大得多
+ *   并集       节点较少的一侧拆成单个节点插入另一侧，插入用的是原来的节点，不再申请
+ *   交集、差集 t1 较小时在 t2 中查找 t1 的每个 key，按运算删除，再清空 t2
+ *   差集       t2 较小时在 t1 中查找并删除 t2 的每个 key
+ * t2 较小的交集不走这里：结果之外的 t1 节点都要释放，代价以释放为主，递归的版本并不慢
+ * 并集移动 t2 的节点同样通过 take_all，内存不足只可能发生在它里面，此时两棵树都不变
+ */
+static int set_by_element(RbTree* t1, RbTree* t2, int op){
+    size_t n1 = t1->size, n2 = t2->size;
+    TNode *n, *next;
+    if(op == SET_UNION){
+        Sub a = whole(t1), b;
+        if(take_all(t1, t2, &b) != 0) return -1;
+        if(n2 > n1){
+            Sub s = a;
+            a = b;
+            b = s;
+        }
+        set_root(t1, a, n1 > n2 ? n1 : n2);
+        while((n = next_leaf(&b.root))) reinsert(t1, n);
+        return 0;
+    }
+    if(n1 <= n2){
+        for(n = t1->leftmost; n; n = next){
+            next = next_node(n);
+            if((search_node(t2, n->value) != NULL) != (op == SET_INTERSECTION)) erase_node(t1, n);
+        }
+        clear_all(t2);
+        return 0;
+    }
+    for(n = t2->leftmost; n; n = next_node(n)){
+        TNode* hit = search_node(t1, n->value);
+        if(hit) erase_node(t1, hit);
+    }
+    clear_all(t2);
+    return 0;
+}
+
+static int set_operation(RbTree* t1, RbTree* t2, int op){
+    SetTask task;
+    if(!t1 || !t2 || t1 == t2) return -1;
+    size_t n1 = t1->size, n2 = t2->size;
+    rebalance_all(t1);
+    if(n1 < n2 ? n1 * SET_ELEMENT_RATIO <= n2 : (n2 * SET_ELEMENT_RATIO <= n1 && op != SET_INTERSECTION))
+        return set_by_element(t1, t2, op);
+    if(take_all(t1, t2, &task.b) != 0) return -1;
+
+    task.tree = t1;
+    task.op = op;
+    task.a = whole(t1);
+    task.depth = fork_depth();
+    task.concurrent = 0;
+    task.drop.head = task.drop.tail = NULL;
+    task.common = 0;
+    set_op(&task);
+
+    size_t size = op == SET_UNION ? n1 + n2 - task.common : op == SET_INTERSECTION ? task.common : n1 - task.common;
+    set_root(t1, task.out, size);
+    free_dropped(t1, &task.drop);
+    return 0;
+}
+
+/**
+ * t1 = t1 ∪ t2，t2 被清空
+ * @return 0 成功，-1 内存不足（只可能在两棵树不共用分配器、需要复制节点时发生，两棵树不变）
+ */
+int tree_union(RbTree* t1, RbTree* t2){
+    return set_operation(t1, t2, SET_UNION);
+}
+
+// t1 = t1 ∩ t2，t2 被清空，返回值同 tree_union
+int tree_intersection(RbTree* t1, RbTree* t2){
+    return set_operation(t1, t2, SET_INTERSECTION);
+}
+
+// t1 = t1 - t2，t2 被清空，返回值同 tree_union
+int tree_difference(RbTree* t1, RbTree* t2){
+    return set_operation(t1, t2, SET_DIFFERENCE);
+}
@@ -0,0 +1,49 @@
+/*
+ * 基于 join/split 的集合运算
+ *
+ * 两棵树合并、求差时，逐个 insert/delete_node 的代价是 O(m log n)，而且完全是串行的。
+ * 这里参考 Blelloch 等人的 "Just Join for Parallel Ordered Sets"，以按黑高拼接的 join 为唯一的平衡操作：
+ *   join(L, k, R)   L 中的 key 都小于 k，R 中的都大于 k，沿着较高的一棵的边缘向下找到黑高相同的位置，
+ *                   把 k 作为红色节点挂上去，再向上修复连续的红色，代价为 O(两者黑高之差 + 1)
+ *   split(T, k)     沿着查找 k 的路径把树拆成小于 k、大于 k 两部分，路径上的节点依次 join 回去，O(log n)
+ * union/intersection/difference 以 T1 的根为界 split T2，两侧递归之后再 join（或者去掉根之后拼接），
+ * 总的工作量为 O(m log(n/m + 1))，m 为较小的树的大小；两侧的递归互不相交，在上面几层用 pthread 分叉并行执行。
+ * 递归中子树都带着自己的黑高，不需要重新计算。一侧远小于另一侧时（SET_ELEMENT_RATIO），
+ * 递归每一层拆开、拼回节点的常数比直接查找大得多，这时改为逐个元素插入、删除。
+ *
+ * 节点在两棵树之间直接移动，不复制：两棵树共用一个分配器时（malloc 分配器，或者 new_tree_sharing 创建的树）没有额外开销，
+ * 否则先把 T2 的节点复制到 T1 的分配器中，O(|T2|)。集合运算的结果放在 T1 中，T2 被清空（树本身仍然有效）。
+ * 只有 T1 维护 size_augment 时，tree_split、tree_extract_range 的 size 才能直接由根节点得到，做到 O(log n)，
+ * 否则需要数一遍分出去的节点。宽松模式下的树会先 rebalance_all。
+ */
+#ifndef RED_BLACK_TREE_JOIN_H
+#define RED_BLACK_TREE_JOIN_H
+
+#include <stddef.h>
+#include "red_black_tree.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// 递归中子树的黑高达到这个值（大约 2^SET_PAR_MIN_BH 个节点以上）才分叉到新线程
+#define SET_PAR_MIN_BH 12
+// 一侧的节点数不超过另一侧的 1/SET_ELEMENT_RATIO 时，集合运算改为逐个元素查找、插入、删除
+#define SET_ELEMENT_RATIO 64
+
+void set_op_threads(int threads);
+
+int tree_join(RbTree* t1, int k, RbTree* t2);
+RbTree* tree_split(RbTree* tree, int k);
+int tree_union(RbTree* t1, RbTree* t2);
+int tree_intersection(RbTree* t1, RbTree* t2);
+int tree_difference(RbTree* t1, RbTree* t2);
+
+RbTree* tree_extract_range(RbTree* tree, int lo, int hi);
+size_t tree_delete_range(RbTree* tree, int lo, int hi);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
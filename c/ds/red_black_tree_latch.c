@@ -0,0 +1,509 @@
+/*
+ * 单写多读的 latch tree，说明见 red_black_tree_latch.h
+ */
+#include <errno.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#ifdef __NR_membarrier
+#include <linux/membarrier.h>
+#endif
+#include "red_black_tree_latch.h"
+
+#define LK(n, i) (&(n)->link[i])
+
+// 读线程并发读取的指针（根、left、right）：写线程用 release 写，读线程用 acquire 读
+static LatchNode* load_child(LatchNode* const* slot){
+    return __atomic_load_n(slot, __ATOMIC_ACQUIRE);
+}
+
+static void store_child(LatchNode** slot, LatchNode* n){
+    __atomic_store_n(slot, n, __ATOMIC_RELEASE);
+}
+
+static Color color_of(const LatchNode* n, int i){
+    return n ? (Color) n->color[i] : BLACK;
+}
+
+// ------------------------- 节点分配 -------------------------
+
+static LatchNode* latch_alloc(LatchTree* t){
+    LatchNode* n = t->free_list;
+    if(n){
+        t->free_list = n->link[0].left;
+        return n;
+    }
+    if(!t->chunks || t->chunk_used == LATCH_CHUNK_NODES){
+        LatchChunk* c = (LatchChunk*) aligned_alloc(64, sizeof(LatchChunk) + LATCH_CHUNK_NODES * sizeof(LatchNode));
+        if(!c){
+            perror("create node error.");
+            return NULL;
+        }
+        c->next = t->chunks;
+        t->chunks = c;
+        t->chunk_used = 0;
+    }
+    return &t->chunks->nodes[t->chunk_used++];
+}
+
+// 调用方需要保证已经没有读线程能访问到 n
+static void latch_free(LatchTree* t, LatchNode* n){
+    n->link[0].left = t->free_list;
+    t->free_list = n;
+}
+
+// ------------------------- 写线程：第 i 棵树上的插入、删除 -------------------------
+
+// 把 parent 指向 old 的指针（parent 为空时是根）改为指向 n
+static void replace_child(LatchTree* t, int i, LatchNode* parent, LatchNode* old, LatchNode* n){
+    if(!parent) store_child(&t->root[i], n);
+    else if(LK(parent, i)->left == old) store_child(&LK(parent, i)->left, n);
+    else store_child(&LK(parent, i)->right, n);
+}
+
+/**
+ * 与 left_rotate 相同，先把 y 的左子树挂到 x 下，再让 y 代替 x，最后把 x 挂到 y 下，
+ * 中间状态下 x 可能暂时不可达，但不会出现环
+ */
+static void rotate_left(LatchTree* t, int i, LatchNode* x){
+    LatchLink* lx = LK(x, i);
+    LatchNode* y = lx->right;
+    LatchLink* ly = LK(y, i);
+    store_child(&lx->right, ly->left);
+    if(ly->left) ly->left->parent[i] = x;
+    y->parent[i] = x->parent[i];
+    replace_child(t, i, x->parent[i], x, y);
+    store_child(&ly->left, x);
+    x->parent[i] = y;
+}
+
+static void rotate_right(LatchTree* t, int i, LatchNode* x){
+    LatchLink* lx = LK(x, i);
+    LatchNode* y = lx->left;
+    LatchLink* ly = LK(y, i);
+    store_child(&lx->left, ly->right);
+    if(ly->right) ly->right->parent[i] = x;
+    y->parent[i] = x->parent[i];
+    replace_child(t, i, x->parent[i], x, y);
+    store_child(&ly->right, x);
+    x->parent[i] = y;
+}
+
+// 与 insert_adjust 相同，用循环代替递归
+static void insert_fix(LatchTree* t, int i, LatchNode* n){
+    while(1){
+        LatchNode* p = n->parent[i];
+        if(!p){
+            n->color[i] = BLACK;
+            return;
+        }
+        if(p->color[i] == BLACK) return;
+
+        LatchNode* g = p->parent[i];
+        LatchNode* u = LK(g, i)->left == p ? LK(g, i)->right : LK(g, i)->left;
+        if(color_of(u, i) == RED){
+            p->color[i] = BLACK;
+            u->color[i] = BLACK;
+            g->color[i] = RED;
+            n = g;
+            continue;
+        }
+        if(p == LK(g, i)->left){
+            if(n == LK(p, i)->right){
+                rotate_left(t, i, p);
+                p = n;
+            }
+            p->color[i] = BLACK;
+            g->color[i] = RED;
+            rotate_right(t, i, g);
+        } else {
+            if(n == LK(p, i)->left){
+                rotate_right(t, i, p);
+                p = n;
+            }
+            p->color[i] = BLACK;
+            g->color[i] = RED;
+            rotate_left(t, i, g);
+        }
+        return;
+    }
+}
+
+// 新节点的链接先初始化好，挂到父节点下（release）之后才对读线程可见
+static void insert_link(LatchTree* t, int i, LatchNode* n){
+    LatchNode *p = NULL, *x = t->root[i];
+    while(x){
+        p = x;
+        x = n->value < x->value ? LK(x, i)->left : LK(x, i)->right;
+    }
+    LatchLink* l = LK(n, i);
+    l->left = l->right = NULL;
+    n->parent[i] = p;
+    n->color[i] = RED;
+    if(!p) store_child(&t->root[i], n);
+    else if(n->value < p->value) store_child(&LK(p, i)->left, n);
+    else store_child(&LK(p, i)->right, n);
+    insert_fix(t, i, n);
+}
+
+// 与 delete_adjust 相同
+static void erase_fix(LatchTree* t, int i, LatchNode* parent, LatchNode* child){
+    LatchNode* b;
+    while(child != t->root[i] && color_of(child, i) == BLACK){
+        LatchLink* lp = LK(parent, i);
+        if(child == lp->left){
+            b = lp->right;
+            if(b->color[i] == RED){
+                b->color[i] = BLACK;
+                parent->color[i] = RED;
+                rotate_left(t, i, parent);
+                b = lp->right;
+            }
+            if(color_of(LK(b, i)->left, i) == BLACK && color_of(LK(b, i)->right, i) == BLACK){
+                b->color[i] = RED;
+                child = parent;
+                parent = parent->parent[i];
+            } else {
+                if(color_of(LK(b, i)->right, i) == BLACK){
+                    LK(b, i)->left->color[i] = BLACK;
+                    b->color[i] = RED;
+                    rotate_right(t, i, b);
+                    b = lp->right;
+                }
+                b->color[i] = parent->color[i];
+                parent->color[i] = BLACK;
+                if(LK(b, i)->right) LK(b, i)->right->color[i] = BLACK;
+                rotate_left(t, i, parent);
+                child = t->root[i];
+                break;
+            }
+        } else {
+            b = lp->left;
+            if(b->color[i] == RED){
+                b->color[i] = BLACK;
+                parent->color[i] = RED;
+                rotate_right(t, i, parent);
+                b = lp->left;
+            }
+            if(color_of(LK(b, i)->left, i) == BLACK && color_of(LK(b, i)->right, i) == BLACK){
+                b->color[i] = RED;
+                child = parent;
+                parent = parent->parent[i];
+            } else {
+                if(color_of(LK(b, i)->left, i) == BLACK){
+                    LK(b, i)->right->color[i] = BLACK;
+                    b->color[i] = RED;
+                    rotate_left(t, i, b);
+                    b = lp->left;
+                }
+                b->color[i] = parent->color[i];
+                parent->color[i] = BLACK;
+                if(LK(b, i)->left) LK(b, i)->left->color[i] = BLACK;
+                rotate_right(t, i, parent);
+                child = t->root[i];
+                break;
+            }
+        }
+    }
+    if(child) child->color[i] = BLACK;
+}
+
+// 与 erase_node 相同，有两个孩子时用右子树的最小节点代替 z 的位置（移动节点而不是复制 key，key 对读线程是不变的）
+static void erase_link(LatchTree* t, int i, LatchNode* z){
+    LatchLink* lz = LK(z, i);
+    LatchNode *child, *parent;
+    Color color;
+    if(lz->left && lz->right){
+        LatchNode* m = lz->right;
+        while(LK(m, i)->left) m = LK(m, i)->left;
+        LatchLink* lm = LK(m, i);
+        color = m->color[i];
+        child = lm->right;
+        parent = m->parent[i] == z ? m : m->parent[i];
+        if(child) child->parent[i] = m->parent[i];
+        replace_child(t, i, m->parent[i], m, child);
+
+        m->parent[i] = z->parent[i];
+        store_child(&lm->left, lz->left);
+        store_child(&lm->right, lz->right);
+        m->color[i] = z->color[i];
+        replace_child(t, i, z->parent[i], z, m);
+        lz->left->parent[i] = m;
+        if(lz->right) lz->right->parent[i] = m;
+    } else {
+        child = lz->left ? lz->left : lz->right;
+        parent = z->parent[i];
+        color = z->color[i];
+        if(child) child->parent[i] = parent;
+        replace_child(t, i, parent, z, child);
+    }
+    if(color == BLACK) erase_fix(t, i, parent, child);
+}
+
+// 与 kernel 的 raw_write_seqcount_latch 相同：之前的修改先于 seq 可见，之后的修改晚于 seq 可见
+static void latch_bump(LatchTree* t){
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    __atomic_store_n(&t->seq, t->seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+// 写线程自己的查找，两棵树在两次修改之间完全相同
+static LatchNode* writer_find(const LatchTree* t, int value){
+    LatchNode* n = t->root[0];
+    while(n && n->value != value) n = value < n->value ? n->link[0].left : n->link[0].right;
+    return n;
+}
+
+// ------------------------- epoch 回收 -------------------------
+
+static int register_membarrier(){
+#ifdef __NR_membarrier
+    return syscall(__NR_membarrier, MEMBARRIER_CMD_REGISTER_PRIVATE_EXPEDITED, 0) == 0;
+#else
+    return 0;
+#endif
+}
+
+/**
+ * 让所有读线程之前对槽位的写对写线程可见
+ * 屏障方式在创建时确定之后不再改变：用 membarrier 时读线程进入只有编译器屏障，
+ * 这时写线程自己的 fence 不能代替它，系统调用失败时只能重试，重试不了就不能继续回收
+ */
+static void reader_barrier(const LatchTree* t){
+#ifdef __NR_membarrier
+    if(t->membarrier){
+        while(syscall(__NR_membarrier, MEMBARRIER_CMD_PRIVATE_EXPEDITED, 0) != 0){
+            if(errno == EINTR || errno == EAGAIN) continue;
+            perror("membarrier error.");
+            abort();
+        }
+        return;
+    }
+#endif
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+/**
+ * 全局 epoch 加一，之后进入的读线程都看不到已经摘除的节点；
+ * 返回所有正在读的线程中最小的 epoch（没有正在读的线程时为新的 epoch），摘除时的 epoch 小于它的节点可以释放
+ */
+static unsigned long advance_epoch(LatchTree* t){
+    unsigned long g = t->epoch + 1, m = g;
+    int k, n;
+    __atomic_store_n(&t->epoch, g, __ATOMIC_RELEASE);
+    reader_barrier(t);
+    n = __atomic_load_n(&t->reader_count, __ATOMIC_ACQUIRE);
+    for(k = 0; k < n; ++k){
+        unsigned long e = __atomic_load_n(&t->readers[k].epoch, __ATOMIC_ACQUIRE);
+        if(e && e < m) m = e;
+    }
+    return m;
+}
+
+// 回收所有已经没有读线程能访问到的节点
+void latch_reclaim(LatchTree* t){
+    size_t k, j = 0;
+    if(!t || !t->retired_count) return;
+    unsigned long m = advance_epoch(t);
+    for(k = 0; k < t->retired_count; ++k){
+        if(t->retired[k].epoch < m) latch_free(t, t->retired[k].node);
+        else t->retired[j++] = t->retired[k];
+    }
+    t->retired_count = j;
+}
+
+// 等到 epoch 为 e 的读线程全部退出，只在记录摘除节点的数组扩容失败时使用
+static void wait_readers(LatchTree* t, unsigned long e){
+    while(advance_epoch(t) <= e) sched_yield();
+}
+
+static void retire(LatchTree* t, LatchNode* n){
+    if(t->retired_count == t->retired_cap){
+        size_t cap = t->retired_cap ? t->retired_cap * 2 : LATCH_RECLAIM_BATCH;
+        Retired* r = (Retired*) realloc(t->retired, cap * sizeof(Retired));
+        if(!r){
+            perror("retire node error.");
+            wait_readers(t, t->epoch);
+            latch_free(t, n);
+            return;
+        }
+        t->retired = r;
+        t->retired_cap = cap;
+    }
+    t->retired[t->retired_count].node = n;
+    t->retired[t->retired_count].epoch = t->epoch;
+    if(++t->retired_count >= LATCH_RECLAIM_BATCH) latch_reclaim(t);
+}
+
+// ------------------------- 创建与写操作 -------------------------
+
+LatchTree* new_latch_tree(){
+    LatchTree* t = (LatchTree*) malloc(sizeof(LatchTree));
+    if(!t) return NULL;
+    t->readers = (LatchReader*) aligned_alloc(64, LATCH_MAX_READERS * sizeof(LatchReader));
+    if(!t->readers){
+        perror("create latch tree error.");
+        free(t);
+        return NULL;
+    }
+    memset(t->readers, 0, LATCH_MAX_READERS * sizeof(LatchReader));
+    t->root[0] = t->root[1] = NULL;
+    t->seq = 0;
+    t->epoch = 1;
+    t->membarrier = register_membarrier();
+    t->reader_count = 0;
+    t->size = 0;
+    t->retired = NULL;
+    t->retired_count = t->retired_cap = 0;
+    t->chunks = NULL;
+    t->chunk_used = 0;
+    t->free_list = NULL;
+    return t;
+}
+
+// 销毁时不能再有读线程，树中、待回收和空闲的节点都在块里，整块释放
+void destroy_latch_tree(LatchTree* t){
+    if(!t) return;
+    LatchChunk* c = t->chunks;
+    while(c){
+        LatchChunk* next = c->next;
+        free(c);
+        c = next;
+    }
+    free(t->retired);
+    free(t->readers);
+    free(t);
+}
+
+/**
+ * 只能由一个写线程调用
+ * @return 与 insert 相同：1 插入，0 已存在，-1 内存不足
+ */
+int latch_insert(LatchTree* t, int value){
+    if(!t) return -1;
+    if(writer_find(t, value)) return 0;
+    LatchNode* n = latch_alloc(t);
+    if(!n) return -1;
+    n->value = value;
+    latch_bump(t);        // 读线程转到第 1 棵
+    insert_link(t, 0, n);
+    latch_bump(t);        // 读线程回到第 0 棵
+    insert_link(t, 1, n);
+    t->size++;
+    return 1;
+}
+
+// 只能由一个写线程调用，返回删除的节点数量
+int latch_delete(LatchTree* t, int value){
+    if(!t) return 0;
+    LatchNode* n = writer_find(t, value);
+    if(!n) return 0;
+    latch_bump(t);
+    erase_link(t, 0, n);
+    latch_bump(t);
+    erase_link(t, 1, n);
+    t->size--;
+    retire(t, n);
+    return 1;
+}
+
+// ------------------------- 读线程 -------------------------
+
+/**
+ * 分配一个槽位，每个读线程调用一次
+ * @return 槽位，超过 LATCH_MAX_READERS 个读线程时返回 NULL
+ */
+LatchReader* latch_register(LatchTree* t){
+    int k;
+    for(k = 0; k < LATCH_MAX_READERS; ++k){
+        int expect = 0;
+        if(__atomic_compare_exchange_n(&t->readers[k].used, &expect, 1, 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)){
+            int c = __atomic_load_n(&t->reader_count, __ATOMIC_RELAXED);
+            while(c < k + 1 && !__atomic_compare_exchange_n(&t->reader_count, &c, k + 1, 0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED));
+            return &t->readers[k];
+        }
+    }
+    return NULL;
+}
+
+void latch_unregister(LatchReader* r){
+    if(!r) return;
+    __atomic_store_n(&r->epoch, 0, __ATOMIC_RELEASE);
+    __atomic_store_n(&r->used, 0, __ATOMIC_RELEASE);
+}
+
+// 进入时只是一次普通的写（自己的槽位），加上编译器屏障或者本核的 fence
+static void read_enter(const LatchTree* t, LatchReader* r){
+    __atomic_store_n(&r->epoch, __atomic_load_n(&t->epoch, __ATOMIC_ACQUIRE), __ATOMIC_RELAXED);
+    if(t->membarrier) __atomic_signal_fence(__ATOMIC_SEQ_CST);
+    else __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+static void read_exit(LatchReader* r){
+    __atomic_store_n(&r->epoch, 0, __ATOMIC_RELEASE);
+}
+
+/**
+ * 在第 i 棵树上查找 value
+ * 向左还是向右直接作为 link 的下标，不用分支：每一层的比较结果都是随机的，分支预测一半会失败，
+ * 失败时要等节点的 cache miss 回来才能纠正，比多一个数据依赖慢得多
+ * @return 1 找到，0 没有，-1 深度超过 LATCH_MAX_DEPTH（正在被修改的树的中间状态），需要重试
+ */
+static int search_copy(const LatchTree* t, int i, int value){
+    LatchNode* n = load_child(&t->root[i]);
+    int depth = 0;
+    while(n && n->value != value){
+        if(++depth > LATCH_MAX_DEPTH) return -1;
+        n = load_child(&(&LK(n, i)->left)[n->value < value]);
+    }
+    return n != NULL;
+}
+
+// 在第 i 棵树上找第一个 >= value 的 key，返回值同 search_copy
+static int lower_copy(const LatchTree* t, int i, int value, int* out){
+    LatchNode* n = load_child(&t->root[i]);
+    int depth = 0, found = 0, best = 0;
+    while(n){
+        if(++depth > LATCH_MAX_DEPTH) return -1;
+        int v = n->value;
+        if(v == value){
+            *out = v;
+            return 1;
+        }
+        int right = v < value;
+        best = right ? best : v;
+        found |= !right;
+        n = load_child(&(&LK(n, i)->left)[right]);
+    }
+    if(found) *out = best;
+    return found;
+}
+
+static int latch_read(LatchTree* t, LatchReader* r, int value, int lower, int* out){
+    unsigned s;
+    int ret;
+    read_enter(t, r);
+    do{
+        s = __atomic_load_n(&t->seq, __ATOMIC_ACQUIRE);
+        ret = lower ? lower_copy(t, s & 1, value, out) : search_copy(t, s & 1, value);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    } while(ret < 0 || __atomic_load_n(&t->seq, __ATOMIC_RELAXED) != s);
+    read_exit(r);
+    return ret;
+}
+
+int latch_contains(LatchTree* t, LatchReader* r, int value){
+    int v;
+    return latch_read(t, r, value, 0, &v);
+}
+
+/**
+ * 第一个 >= value 的 key
+ * @return 1 存在（写入 *out），0 不存在
+ */
+int latch_lower_bound(LatchTree* t, LatchReader* r, int value, int* out){
+    return latch_read(t, r, value, 1, out);
+}
@@ -0,0 +1,103 @@
+/*
+ * 单写多读、读不加锁的红黑树（latch tree）
+ *
+ * 读多写少的场景下，即使用读写锁保护 search_node，每次加锁解锁也是对同一条 cache line 的原子操作，核数多了之后锁本身就成了瓶颈。
+ * 这里参考 Linux kernel 的 latch_tree：每个节点有两套链接（link[0]、link[1]），相当于同一组节点上的两棵红黑树，
+ * 写线程用一个序列号 seq 在两棵之间切换：
+ *   seq++（奇数），修改第 0 棵；seq++（偶数），修改第 1 棵
+ * 读线程读 seq，在第 seq & 1 棵上查找，结束后 seq 没有变化说明这次查找期间这棵树没有被修改，否则重试。
+ * 任何时刻总有一棵树是完整的，读线程只读 seq、节点和 left/right 指针，没有任何原子的读改写操作，不写共享的 cache line。
+ * 查找时被修改的那一棵可能处于旋转的中间状态，查找深度超过 LATCH_MAX_DEPTH 时直接重试，不会陷入死循环。
+ *
+ * 删除的节点在两棵树中都摘除之后，还可能有读线程正在访问，采用 epoch 回收：
+ * 读线程进入时把全局 epoch 写入自己独占一条 cache line 的槽位，退出时清零；写线程每攒够 LATCH_RECLAIM_BATCH 个节点，
+ * 把全局 epoch 加一，检查所有槽位，把摘除时的 epoch 小于所有正在读的线程的 epoch 的节点放回空闲链表。
+ * 节点从 64 字节对齐的块中切出（LATCH_CHUNK_NODES 个一块），每个节点正好占一条 cache line，
+ * 逐个 aligned_alloc 时 glibc 的头部和对齐会让每个节点占到 192 字节。
+ * 读线程写槽位与读树之间需要 store-load 屏障，系统支持 membarrier 时由写线程在回收时用 membarrier 代替，
+ * 读线程只需要编译器屏障；否则读线程每次进入执行一次 seq_cst fence（只涉及本核，不会在核之间来回传递 cache line）。
+ *
+ * 写操作（latch_insert / latch_delete）只能有一个线程，多个写线程需要在外面加锁；
+ * 读线程先 latch_register 得到槽位，之后用 latch_contains / latch_lower_bound 查找，查找结果是 key 的值而不是节点指针。
+ */
+#ifndef RED_BLACK_TREE_LATCH_H
+#define RED_BLACK_TREE_LATCH_H
+
+#include <stddef.h>
+#include "red_black_tree.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define LATCH_MAX_READERS   128
+#define LATCH_RECLAIM_BATCH 64
+#define LATCH_MAX_DEPTH     128
+#define LATCH_CHUNK_NODES   1024
+
+// left/right 会被读线程并发读取，写线程用原子写
+typedef struct LatchLink{
+    struct LatchNode* left;
+    struct LatchNode* right;
+} LatchLink;
+
+// 读线程只访问 value 和 link，放在最前面；节点按 64 字节对齐，一次查找每个节点只读一条 cache line
+typedef struct LatchNode{
+    int value;
+    LatchLink link[2];
+    struct LatchNode* parent[2];   // parent、color 只有写线程访问
+    unsigned char color[2];
+} __attribute__((aligned(64))) LatchNode;
+
+// 节点按块分配，块按 64 字节对齐，节点之间没有 malloc 的头部，回收的节点通过 link[0].left 串成空闲链表
+typedef struct LatchChunk{
+    struct LatchChunk* next;
+    LatchNode nodes[];
+} LatchChunk;
+
+// 读线程的槽位，epoch 为 0 表示不在读
+typedef struct LatchReader{
+    unsigned long epoch;
+    int used;
+} __attribute__((aligned(64))) LatchReader;
+
+typedef struct Retired{
+    LatchNode* node;
+    unsigned long epoch;       // 摘除时的全局 epoch
+} Retired;
+
+typedef struct LatchTree{
+    LatchNode* root[2];
+    unsigned seq;
+    unsigned long epoch;
+    int membarrier;            // 是否可以用 membarrier 代替读线程的屏障
+    int reader_count;          // 用过的槽位数的上界，回收时只检查这么多
+    size_t size;
+    Retired* retired;
+    size_t retired_count;
+    size_t retired_cap;
+    LatchReader* readers;      // LATCH_MAX_READERS 个
+    LatchChunk* chunks;        // 只有写线程访问
+    size_t chunk_used;         // 表头块中已切出的节点数
+    LatchNode* free_list;      // 已经没有读线程能访问到的节点
+} LatchTree;
+
+LatchTree* new_latch_tree();
+void destroy_latch_tree(LatchTree* tree);
+
+// 写线程
+int latch_insert(LatchTree* tree, int value);
+int latch_delete(LatchTree* tree, int value);
+void latch_reclaim(LatchTree* tree);
+
+// 读线程
+LatchReader* latch_register(LatchTree* tree);
+void latch_unregister(LatchReader* reader);
+int latch_contains(LatchTree* tree, LatchReader* reader, int value);
+int latch_lower_bound(LatchTree* tree, LatchReader* reader, int value, int* out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
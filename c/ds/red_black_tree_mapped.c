@@ -0,0 +1,614 @@
+/*
+ * 基于 mmap 的磁盘红黑树，说明见 red_black_tree_mapped.h
+ */
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "red_black_tree_mapped.h"
+
+// 下标最高位为 1 表示堆上的节点
+#define MAPPED_HEAP 0x80000000u
+#define MAPPED_CHUNK_SHIFT 12
+#define MAPPED_CHUNK (1u << MAPPED_CHUNK_SHIFT)
+
+// 与 red_black_tree_persistent.c 相同，删除时 case 1 的旋转会让路径变长一层
+#define PATH_MAX_DEPTH 72
+
+static MNode* node_at(const MappedTree* t, uint32_t r){
+    if(r & MAPPED_HEAP){
+        r &= ~MAPPED_HEAP;
+        return &t->chunks[r >> MAPPED_CHUNK_SHIFT][r & (MAPPED_CHUNK - 1)];
+    }
+    return (MNode*) &t->file_nodes[r];
+}
+
+#define IS_RED(t, r) ((r) && node_at(t, r)->color == RED)
+
+/**
+ * r 是否指向一个存在的节点：文件中的下标小于 file_count，堆上的下标小于 heap_used
+ * 文件中的下标来自磁盘，损坏或截断的文件可能指向映射之外，所有沿着下标向下走的地方都先检查
+ */
+static int valid_ref(const MappedTree* t, uint32_t r){
+    if(r & MAPPED_HEAP) return (r & ~MAPPED_HEAP) < t->heap_used;
+    return r && r < t->file_count;
+}
+
+// ------------------------- 写文件 -------------------------
+typedef struct Writer{
+    int fd;
+    void* map;
+    size_t len;
+    MNode* nodes;
+    uint32_t next;
+} Writer;
+
+// 创建文件并映射为可写，count 为要写入的节点个数
+static int begin_file(Writer* w, const char* path, size_t count){
+    if(count + 1 >= MAPPED_HEAP){
+        fprintf(stderr, "save tree error: too many nodes.\n");
+        return -1;
+    }
+    w->len = sizeof(MappedHeader) + (count + 1) * sizeof(MNode);
+    w->fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if(w->fd < 0){
+        perror("save tree error.");
+        return -1;
+    }
+    if(ftruncate(w->fd, (off_t) w->len) != 0){
+        perror("save tree error.");
+        close(w->fd);
+        return -1;
+    }
+    w->map = mmap(NULL, w->len, PROT_READ | PROT_WRITE, MAP_SHARED, w->fd, 0);
+    if(w->map == MAP_FAILED){
+        perror("save tree error.");
+        close(w->fd);
+        return -1;
+    }
+    w->nodes = (MNode*) ((char*) w->map + sizeof(MappedHeader));
+    w->nodes[0].left = w->nodes[0].right = 0;
+    w->nodes[0].value = 0;
+    w->nodes[0].color = BLACK;
+    w->next = 1;
+    return 0;
+}
+
+// 最后写文件头，中途失败的文件 magic 为 0，不会被 open_mapped 打开
+static int end_file(Writer* w, uint64_t size, uint32_t root){
+    MappedHeader* h = (MappedHeader*) w->map;
+    int ret = 0;
+    h->version = MAPPED_VERSION;
+    h->size = size;
+    h->nodes = w->next;
+    h->root = root;
+    h->magic = MAPPED_MAGIC;
+    if(msync(w->map, w->len, MS_SYNC) != 0){
+        perror("save tree error.");
+        ret = -1;
+    }
+    munmap(w->map, w->len);
+    close(w->fd);
+    return ret;
+}
+
+/**
+ * 前序写出：节点的下标在出栈时分配，再回填到父节点中对应的 left/right 上，
+ * 栈中同时只有一条路径上的右孩子，深度不超过树高
+ * @return 0 成功，-1 失败（包括宽松模式下还有未修复的冲突，需要先 rebalance_all）
+ */
+int save_tree(const RbTree* tree, const char* path){
+    struct { const TNode* node; uint32_t* link; } stack[PATH_MAX_DEPTH];
+    int top = 0;
+    uint32_t root = 0;
+    Writer w;
+    if(!tree || tree->pending_count || begin_file(&w, path, tree->size) != 0) return -1;
+
+    if(tree->root){
+        stack[top].node = tree->root;
+        stack[top++].link = &root;
+    }
+    while(top){
+        const TNode* n = stack[--top].node;
+        uint32_t i = w.next++;
+        MNode* o = &w.nodes[i];
+        *stack[top].link = i;
+        o->left = o->right = 0;
+        o->value = n->value;
+        o->color = n->color;
+        if(n->right){
+            stack[top].node = n->right;
+            stack[top++].link = &o->right;
+        }
+        if(n->left){
+            stack[top].node = n->left;
+            stack[top++].link = &o->left;
+        }
+    }
+    return end_file(&w, tree->size, root);
+}
+
+// 写到一半发现节点损坏，丢弃这个文件
+static void abort_file(Writer* w, const char* path){
+    munmap(w->map, w->len);
+    close(w->fd);
+    unlink(path);
+}
+
+/**
+ * 把打开的树（包括堆上修改过的节点）写入新文件，path 不能是当前映射的文件
+ * @return 0 成功，-1 失败（包括遇到越界的下标、节点数与 size 不符、深度超过 PATH_MAX_DEPTH 的损坏文件）
+ */
+int save_mapped(const MappedTree* tree, const char* path){
+    struct { uint32_t ref; uint32_t* link; } stack[PATH_MAX_DEPTH];
+    int top = 0;
+    uint32_t root = 0;
+    Writer w;
+    if(!tree || begin_file(&w, path, tree->size) != 0) return -1;
+
+    if(tree->root){
+        stack[top].ref = tree->root;
+        stack[top++].link = &root;
+    }
+    while(top){
+        uint32_t r = stack[--top].ref;
+        // 栈中最多同时有每层一个右孩子，再加当前节点的两个孩子
+        if(!valid_ref(tree, r) || w.next > tree->size || top + 2 > PATH_MAX_DEPTH){
+            fprintf(stderr, "save mapped tree error: corrupted node.\n");
+            abort_file(&w, path);
+            return -1;
+        }
+        const MNode* n = node_at(tree, r);
+        uint32_t i = w.next++;
+        MNode* o = &w.nodes[i];
+        *stack[top].link = i;
+        o->left = o->right = 0;
+        o->value = n->value;
+        o->color = n->color;
+        if(n->right){
+            stack[top].ref = n->right;
+            stack[top++].link = &o->right;
+        }
+        if(n->left){
+            stack[top].ref = n->left;
+            stack[top++].link = &o->left;
+        }
+    }
+    return end_file(&w, tree->size, root);
+}
+
+// ------------------------- 打开 -------------------------
+/**
+ * 只检查文件头和文件长度，不读取任何节点，启动时间与树的大小无关；
+ * 节点中的下标在查找、遍历、修改时检查，越界或者深度超过红黑树可能的高度时按文件损坏处理
+ * 查找是随机访问，关闭预读，冷查找只读入路径上的页
+ */
+MappedTree* open_mapped(const char* path){
+    struct stat st;
+    int fd = open(path, O_RDONLY);
+    if(fd < 0){
+        perror("open mapped tree error.");
+        return NULL;
+    }
+    if(fstat(fd, &st) != 0){
+        perror("open mapped tree error.");
+        close(fd);
+        return NULL;
+    }
+    if((size_t) st.st_size < sizeof(MappedHeader) + sizeof(MNode)){
+        fprintf(stderr, "open mapped tree error: %s is too small.\n", path);
+        close(fd);
+        return NULL;
+    }
+
+    size_t len = (size_t) st.st_size;
+    void* map = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(map == MAP_FAILED){
+        perror("open mapped tree error.");
+        return NULL;
+    }
+    const MappedHeader* h = (const MappedHeader*) map;
+    if(h->magic != MAPPED_MAGIC || h->version != MAPPED_VERSION || h->nodes == 0 || h->nodes >= MAPPED_HEAP
+        || len != sizeof(MappedHeader) + h->nodes * sizeof(MNode) || h->root >= h->nodes || h->size >= h->nodes){
+        fprintf(stderr, "open mapped tree error: %s is not a tree file.\n", path);
+        munmap(map, len);
+        return NULL;
+    }
+    madvise(map, len, MADV_RANDOM);
+
+    MappedTree* tree = (MappedTree*) malloc(sizeof(MappedTree));
+    if(!tree){
+        perror("open mapped tree error.");
+        munmap(map, len);
+        return NULL;
+    }
+    tree->map = map;
+    tree->map_len = len;
+    tree->file_nodes = (const MNode*) ((const char*) map + sizeof(MappedHeader));
+    tree->file_count = (uint32_t) h->nodes;
+    tree->chunks = NULL;
+    tree->chunk_count = 0;
+    tree->heap_used = 0;
+    tree->free_list = 0;
+    tree->root = h->root;
+    tree->size = h->size;
+    return tree;
+}
+
+void close_mapped(MappedTree* tree){
+    uint32_t i;
+    if(!tree) return;
+    for(i = 0; i < tree->chunk_count; ++i) free(tree->chunks[i]);
+    free(tree->chunks);
+    munmap(tree->map, tree->map_len);
+    free(tree);
+}
+
+// ------------------------- 查找与遍历 -------------------------
+// 文件损坏（下标越界、路径过长）时也返回空
+const MNode* mapped_search(const MappedTree* tree, int value){
+    uint32_t r = tree->root;
+    int depth = 0;
+    while(r){
+        if(!valid_ref(tree, r) || ++depth > PATH_MAX_DEPTH) return NULL;
+        const MNode* n = node_at(tree, r);
+        if(n->value == value) return n;
+        r = value < n->value ? n->left : n->right;
+    }
+    return NULL;
+}
+
+#define MITER_DEPTH ((int)(sizeof(((MIter*) 0)->stack) / sizeof(uint32_t)))
+
+// 遇到损坏的节点时清空栈并置 bad，遍历到此结束
+static int miter_push(MIter* it, const MappedTree* tree, uint32_t r){
+    if(it->top == MITER_DEPTH || !valid_ref(tree, r)){
+        it->top = 0;
+        it->bad = 1;
+        return 0;
+    }
+    it->stack[it->top++] = r;
+    return 1;
+}
+
+static void miter_push_left(MIter* it, const MappedTree* tree, uint32_t r){
+    while(r && miter_push(it, tree, r))
+        r = node_at(tree, r)->left;
+}
+
+void miter_begin(MIter* it, const MappedTree* tree){
+    it->top = 0;
+    it->bad = 0;
+    miter_push_left(it, tree, tree->root);
+}
+
+// 定位到第一个 >= value 的节点，之后的 miter_next 从它开始返回
+void miter_seek(MIter* it, const MappedTree* tree, int value){
+    uint32_t r = tree->root;
+    int depth = 0;
+    it->top = 0;
+    it->bad = 0;
+    while(r){
+        if(!valid_ref(tree, r) || ++depth > PATH_MAX_DEPTH){
+            it->top = 0;
+            it->bad = 1;
+            return;
+        }
+        const MNode* n = node_at(tree, r);
+        if(value <= n->value){
+            if(!miter_push(it, tree, r)) return;
+            r = n->left;
+        } else {
+            r = n->right;
+        }
+    }
+}
+
+const MNode* miter_next(MIter* it, const MappedTree* tree){
+    if(it->top == 0) return NULL;
+    const MNode* n = node_at(tree, it->stack[--it->top]);
+    miter_push_left(it, tree, n->right);
+    return n;
+}
+
+// ------------------------- 修改（copy on write） -------------------------
+static int add_chunk(MappedTree* t){
+    if(t->chunk_count * MAPPED_CHUNK >= MAPPED_HEAP - MAPPED_CHUNK){
+        fprintf(stderr, "create node error: too many nodes.\n");
+        return -1;
+    }
+    MNode** chunks = (MNode**) realloc(t->chunks, (t->chunk_count + 1) * sizeof(MNode*));
+    if(!chunks){
+        perror("create node error.");
+        return -1;
+    }
+    t->chunks = chunks;
+    t->chunks[t->chunk_count] = (MNode*) malloc(MAPPED_CHUNK * sizeof(MNode));
+    if(!t->chunks[t->chunk_count]){
+        perror("create node error.");
+        return -1;
+    }
+    t->chunk_count++;
+    return 0;
+}
+
+/**
+ * 保证之后至少还能申请 need 个堆节点，写操作修改任何节点之前调用，
+ * 之后的 heap_alloc 不会失败，不会因为内存不足留下改了一半的树
+ * @return 0 成功，-1 内存不足
+ */
+static int heap_reserve(MappedTree* t, uint32_t need){
+    while(t->chunk_count * MAPPED_CHUNK - t->heap_used < need)
+        if(add_chunk(t) != 0) return -1;
+    return 0;
+}
+
+// 先复用回收的节点，否则从 chunk 中切出，调用方需要先 heap_reserve
+static uint32_t heap_alloc(MappedTree* t){
+    uint32_t r = t->free_list;
+    if(r){
+        t->free_list = node_at(t, r)->left;
+        return r;
+    }
+    return MAPPED_HEAP | t->heap_used++;
+}
+
+// 文件中的节点直接丢弃，空间在下一次 save_mapped 时回收
+static void heap_free(MappedTree* t, uint32_t r){
+    if(!(r & MAPPED_HEAP)) return;
+    node_at(t, r)->left = t->free_list;
+    t->free_list = r;
+}
+
+/**
+ * 与 red_black_tree_persistent.c 中的 own 相同：*link 指向文件中的节点时复制到堆上并替换 *link，
+ * 堆上的节点只属于这一棵树，可以直接修改
+ */
+static MNode* own(MappedTree* t, uint32_t* link){
+    uint32_t r = *link;
+    if(!r || (r & MAPPED_HEAP)) return r ? node_at(t, r) : NULL;
+
+    uint32_t c = heap_alloc(t);
+    *node_at(t, c) = *node_at(t, r);
+    *link = c;
+    return node_at(t, c);
+}
+
+static uint32_t* child_link(MappedTree* t, uint32_t parent, uint32_t n){
+    MNode* p = node_at(t, parent);
+    return p->left == n ? &p->left : &p->right;
+}
+
+static uint32_t* path_link(MappedTree* t, uint32_t* path, int i){
+    return i == 0 ? &t->root : child_link(t, path[i - 1], path[i]);
+}
+
+// dir 为 0 时左旋，为 1 时右旋，两个节点都必须已经在堆上
+static void rotate(MappedTree* t, uint32_t* link, int dir){
+    uint32_t nr = *link;
+    MNode* n = node_at(t, nr);
+    uint32_t cr;
+    if(dir == 0){
+        cr = n->right;
+        n->right = node_at(t, cr)->left;
+        node_at(t, cr)->left = nr;
+    } else {
+        cr = n->left;
+        n->left = node_at(t, cr)->right;
+        node_at(t, cr)->right = nr;
+    }
+    *link = cr;
+}
+
+// r 以及它之下 levels 层以内的节点的下标都有效
+static int check_near(const MappedTree* t, uint32_t r, int levels){
+    if(!r) return 1;
+    if(!valid_ref(t, r)) return 0;
+    if(!levels) return 1;
+    const MNode* n = node_at(t, r);
+    return check_near(t, n->left, levels - 1) && check_near(t, n->right, levels - 1);
+}
+
+/**
+ * 写操作开始前沿着 copy_path 将要走的路径检查下标：调整时会访问路径上节点的兄弟、兄弟的孩子，
+ * 删除的 case 1 旋转之后还会访问再下一层，因此每个路径上的节点检查到它之下 3 层。
+ * 删除并且目标有两个孩子时路径继续到后继。
+ * @return 路径上的节点数，*found 表示 value 是否存在；下标越界或者路径过长（文件损坏）时返回 -1
+ */
+static int check_path(const MappedTree* t, int value, int erase, int* found){
+    uint32_t r = t->root;
+    int depth = 0;
+    *found = 0;
+    while(r){
+        // 留出删除时 case 1 加长的一层
+        if(depth + 2 > PATH_MAX_DEPTH || !check_near(t, r, 3)) return -1;
+        const MNode* n = node_at(t, r);
+        ++depth;
+        if(!*found && n->value == value){
+            *found = 1;
+            if(!erase || !n->left || !n->right) break;
+            r = n->right;
+            continue;
+        }
+        r = *found || value < n->value ? n->left : n->right;
+    }
+    return depth;
+}
+
+static int copy_path(MappedTree* t, uint32_t* path, int value){
+    int depth = 0;
+    uint32_t* link = &t->root;
+    while(*link){
+        MNode* n = own(t, link);
+        path[depth++] = *link;
+        if(value == n->value) break;
+        link = value < n->value ? &n->left : &n->right;
+    }
+    return depth;
+}
+
+/**
+ * 插入，过程与 pinsert 相同，开始修改前检查路径并预留最多需要的 2d + 2 个堆节点
+ * @return 1 插入成功，0 已存在，-1 内存不足或文件损坏（树不变）
+ */
+int mapped_insert(MappedTree* t, int value){
+    int found;
+    if(!t) return 0;
+    int d = check_path(t, value, 0, &found);
+    if(d < 0){
+        fprintf(stderr, "mapped insert error: corrupted node.\n");
+        return -1;
+    }
+    if(found) return 0;
+    if(heap_reserve(t, 2 * d + 2) != 0) return -1;
+
+    uint32_t path[PATH_MAX_DEPTH];
+    int k = copy_path(t, path, value) - 1;
+
+    uint32_t x = heap_alloc(t);
+    MNode* xn = node_at(t, x);
+    xn->left = xn->right = 0;
+    xn->value = value;
+    xn->color = RED;
+    if(k < 0){
+        t->root = x;
+    } else if(value < node_at(t, path[k])->value){
+        node_at(t, path[k])->left = x;
+    } else {
+        node_at(t, path[k])->right = x;
+    }
+
+    while(k >= 1 && IS_RED(t, path[k])){
+        uint32_t p = path[k];
+        uint32_t g = path[k - 1];
+        MNode* gn = node_at(t, g);
+        int pdir = gn->left == p ? 0 : 1;
+        uint32_t* ulink = pdir == 0 ? &gn->right : &gn->left;
+        if(IS_RED(t, *ulink)){
+            own(t, ulink)->color = BLACK;
+            node_at(t, p)->color = BLACK;
+            gn->color = RED;
+            x = g;
+            k -= 2;
+            continue;
+        }
+
+        int xdir = node_at(t, p)->left == x ? 0 : 1;
+        if(xdir != pdir){
+            rotate(t, child_link(t, g, p), pdir);
+            p = x;
+        }
+        node_at(t, p)->color = BLACK;
+        gn->color = RED;
+        rotate(t, path_link(t, path, k - 1), !pdir);
+        break;
+    }
+    node_at(t, t->root)->color = BLACK;
+
+    t->size++;
+    return 1;
+}
+
+/**
+ * 删除，过程与 pdelete 相同，开始修改前检查路径并预留最多需要的 5d + 6 个堆节点
+ * @return 删除的节点数量，-1 内存不足或文件损坏（树不变）
+ */
+int mapped_delete(MappedTree* t, int value){
+    int found;
+    if(!t) return 0;
+    int d = check_path(t, value, 1, &found);
+    if(d < 0){
+        fprintf(stderr, "mapped delete error: corrupted node.\n");
+        return -1;
+    }
+    if(!found) return 0;
+    if(heap_reserve(t, 5 * d + 6) != 0) return -1;
+
+    uint32_t path[PATH_MAX_DEPTH];
+    int k = copy_path(t, path, value) - 1;
+    MNode* del = node_at(t, path[k]);
+
+    if(del->left && del->right){
+        uint32_t* link = &del->right;
+        while(1){
+            MNode* n = own(t, link);
+            path[++k] = *link;
+            if(!n->left) break;
+            link = &n->left;
+        }
+        del->value = node_at(t, path[k])->value;
+        del = node_at(t, path[k]);
+    }
+
+    uint32_t child = del->left ? del->left : del->right;
+    uint32_t delColor = del->color;
+    *path_link(t, path, k) = child;
+    heap_free(t, path[k]);
+    --k;
+
+    if(delColor == BLACK){
+        uint32_t x = child;
+        while(k >= 0 && !IS_RED(t, x)){
+            uint32_t parent = path[k];
+            MNode* pn = node_at(t, parent);
+            int xdir = pn->left == x ? 0 : 1;
+            uint32_t* wlink = xdir == 0 ? &pn->right : &pn->left;
+            MNode* w = own(t, wlink);
+
+            if(w->color == RED){
+                // case 1
+                uint32_t wr = *wlink;
+                w->color = BLACK;
+                pn->color = RED;
+                rotate(t, path_link(t, path, k), xdir);
+                path[k + 1] = parent;
+                path[k] = wr;
+                ++k;
+                wlink = xdir == 0 ? &pn->right : &pn->left;
+                w = own(t, wlink);
+            }
+
+            uint32_t* nearLink = xdir == 0 ? &w->left : &w->right;
+            uint32_t* farLink = xdir == 0 ? &w->right : &w->left;
+            if(!IS_RED(t, *nearLink) && !IS_RED(t, *farLink)){
+                // case 2
+                w->color = RED;
+                x = parent;
+                --k;
+                continue;
+            }
+
+            if(!IS_RED(t, *farLink)){
+                // case 3
+                own(t, nearLink)->color = BLACK;
+                w->color = RED;
+                rotate(t, wlink, !xdir);
+                w = node_at(t, *wlink);
+                farLink = xdir == 0 ? &w->right : &w->left;
+            }
+
+            // case 4
+            MNode* far = own(t, farLink);
+            w->color = pn->color;
+            pn->color = BLACK;
+            far->color = BLACK;
+            rotate(t, path_link(t, path, k), xdir);
+            x = t->root;
+            k = -1;
+            break;
+        }
+
+        if(IS_RED(t, x)){
+            uint32_t* xlink = k >= 0 ? child_link(t, path[k], x) : &t->root;
+            own(t, xlink)->color = BLACK;
+        }
+    }
+
+    if(IS_RED(t, t->root)) own(t, &t->root)->color = BLACK;
+
+    t->size--;
+    return 1;
+}
@@ -0,0 +1,83 @@
+/*
+ * 基于 mmap 的磁盘红黑树
+ *
+ * 重启时逐个 insert 重建一棵大树需要很长时间。save_tree 把树按前序写入文件，节点之间用下标代替指针，
+ * open_mapped 只需要 mmap 文件并检查文件头，不做任何反序列化，查找和中序遍历直接读映射的内存，
+ * 冷启动后的查找只会把路径上用到的页读入内存。前序排列使得子树在文件中是连续的，底部的若干层和父节点在同一页中。
+ *
+ * 文件格式（小端，与本机一致）：
+ *   [0, 64)             MappedHeader
+ *   [64, 64 + 16 * n)   MNode 数组，下标 0 不使用，下标 0 表示空
+ *
+ * 映射是只读的，对打开的树做插入、删除时，根到修改位置路径上的节点被复制到堆上（copy on write），
+ * 下标的最高位为 1 表示堆上的节点，文件本身不会被修改，需要持久化时对 MappedTree 再调用 save_mapped。
+ */
+#ifndef RED_BLACK_TREE_MAPPED_H
+#define RED_BLACK_TREE_MAPPED_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "red_black_tree.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define MAPPED_MAGIC   0x4d544252u   // "RBTM"
+#define MAPPED_VERSION 1u
+
+typedef struct MNode{
+    uint32_t left;
+    uint32_t right;
+    int value;
+    uint32_t color;
+} MNode;
+
+typedef struct MappedHeader{
+    uint32_t magic;
+    uint32_t version;
+    uint64_t size;          // key 的个数
+    uint64_t nodes;         // MNode 数组的长度，包括不使用的下标 0
+    uint32_t root;
+    uint32_t reserved[9];
+} MappedHeader;
+
+typedef struct MappedTree{
+    void* map;
+    size_t map_len;
+    const MNode* file_nodes;
+    uint32_t file_count;
+    MNode** chunks;         // 堆上的节点按块分配，地址不会移动
+    uint32_t chunk_count;
+    uint32_t heap_used;
+    uint32_t free_list;     // 回收的堆节点，通过 left 串联
+    uint32_t root;
+    size_t size;
+} MappedTree;
+
+// 中序遍历迭代器，显式栈；bad 非 0 表示遇到了损坏的节点，遍历提前结束
+typedef struct MIter{
+    uint32_t stack[64];
+    int top;
+    int bad;
+} MIter;
+
+int save_tree(const RbTree* tree, const char* path);
+int save_mapped(const MappedTree* tree, const char* path);
+
+MappedTree* open_mapped(const char* path);
+void close_mapped(MappedTree* tree);
+
+const MNode* mapped_search(const MappedTree* tree, int value);
+int mapped_insert(MappedTree* tree, int value);
+int mapped_delete(MappedTree* tree, int value);
+
+void miter_begin(MIter* it, const MappedTree* tree);
+void miter_seek(MIter* it, const MappedTree* tree, int value);
+const MNode* miter_next(MIter* it, const MappedTree* tree);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,380 @@
+/*
+ * 可持久化（path copying）红黑树，说明见 red_black_tree_persistent.h
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include "red_black_tree_persistent.h"
+
+// 路径的最大长度，删除时 case 1 的旋转会让路径变长一层
+#define PATH_MAX_DEPTH 72
+
+#define IS_RED(n) ((n) && (n)->color == RED)
+
+static void incref(PNode* n){
+    if(n) __atomic_add_fetch(&n->refs, 1, __ATOMIC_RELAXED);
+}
+
+// 引用计数减为 0 时释放节点，并递归释放子节点的引用（深度不超过树高）
+static void decref(PNode* n){
+    while(n && __atomic_sub_fetch(&n->refs, 1, __ATOMIC_ACQ_REL) == 0){
+        PNode* l = n->left;
+        PNode* r = n->right;
+        free(n);
+        decref(l);
+        n = r;
+    }
+}
+
+/**
+ * 写操作开始前准备好最多可能用到的 need 个节点（通过 left 串在 tree->spare 上，用剩的留给下一次写操作），
+ * 之后的复制和新建不会失败，不会因为内存不足留下改了一半的树
+ * @return 0 成功，-1 内存不足
+ */
+static int reserve_nodes(PRbTree* tree, size_t need){
+    while(tree->spare_count < need){
+        PNode* n = (PNode*) malloc(sizeof(PNode));
+        if(!n){
+            perror("create node error.");
+            return -1;
+        }
+        n->left = tree->spare;
+        tree->spare = n;
+        tree->spare_count++;
+    }
+    return 0;
+}
+
+// 从预留的节点中取一个，调用方需要先 reserve_nodes
+static PNode* pnode_new(PRbTree* tree, int value){
+    PNode* n = tree->spare;
+    tree->spare = n->left;
+    tree->spare_count--;
+    n->left = n->right = NULL;
+    n->value = value;
+    n->color = RED;
+    n->refs = 1;
+    n->version = tree->version;
+    return n;
+}
+
+/**
+ * 返回一个可以原地修改的节点：
+ * 如果 *link 指向的节点是上一次 psnapshot 之后创建的，直接返回；否则复制一份替换 *link，
+ * 复制出的节点继承子节点的引用，原节点失去 *link 这一个引用。
+ * 调用方需要保证 *link 所在的节点（或根）本身已经是可修改的
+ */
+static PNode* own(PRbTree* tree, PNode** link){
+    PNode* n = *link;
+    if(!n || n->version == tree->version) return n;
+
+    PNode* c = pnode_new(tree, n->value);
+    c->color = n->color;
+    c->left = n->left;
+    c->right = n->right;
+    incref(c->left);
+    incref(c->right);
+    *link = c;
+    decref(n);
+    return c;
+}
+
+static PNode** child_link(PNode* parent, PNode* n){
+    return parent->left == n ? &parent->left : &parent->right;
+}
+
+/**
+ * 旋转 *link 指向的节点，dir 为 0 时左旋（右孩子上升），为 1 时右旋（左孩子上升）
+ * 参与旋转的两个节点必须都是可修改的，被移动的子树只是换了父节点，引用计数不变
+ */
+static PNode* rotate(PRbTree* tree, PNode** link, int dir){
+    PNode* n = *link;
+    PNode* c;
+    tree->rotations++;
+    if(dir == 0){
+        c = n->right;
+        n->right = c->left;
+        c->left = n;
+    } else {
+        c = n->left;
+        n->left = c->right;
+        c->right = n;
+    }
+    *link = c;
+    return c;
+}
+
+PRbTree* new_ptree(){
+    PRbTree* tree = (PRbTree*) malloc(sizeof(PRbTree));
+    if(!tree){
+        perror("create tree error.");
+        return NULL;
+    }
+    tree->root = NULL;
+    tree->size = 0;
+    tree->version = 1;
+    tree->spare = NULL;
+    tree->spare_count = 0;
+    tree->rotations = 0;
+    return tree;
+}
+
+void destroy_ptree(PRbTree* tree){
+    if(!tree) return;
+    decref(tree->root);
+    while(tree->spare){
+        PNode* n = tree->spare;
+        tree->spare = n->left;
+        free(n);
+    }
+    free(tree);
+}
+
+const PNode* psearch(const PNode* n, int value){
+    while(n && n->value != value)
+        n = value < n->value ? n->left : n->right;
+    return n;
+}
+
+/**
+ * 根到 value 的路径上的节点数，*node 为 value 所在的节点（不存在时为空）
+ */
+static size_t search_depth(const PNode* n, int value, const PNode** node){
+    size_t depth = 0;
+    while(n && n->value != value){
+        ++depth;
+        n = value < n->value ? n->left : n->right;
+    }
+    *node = n;
+    return n ? depth + 1 : depth;
+}
+
+/**
+ * 复制根到目标位置的路径：path[0..depth] 依次为复制后的节点，path[0] 为根
+ */
+static int copy_path(PRbTree* tree, PNode** path, int value, int* found){
+    int depth = 0;
+    PNode** link = &tree->root;
+    *found = 0;
+    while(*link){
+        PNode* n = own(tree, link);
+        path[depth++] = n;
+        if(value == n->value){
+            *found = 1;
+            break;
+        }
+        link = value < n->value ? &n->left : &n->right;
+    }
+    return depth;
+}
+
+// path[i] 在其父节点（或根）中的位置
+static PNode** path_link(PRbTree* tree, PNode** path, int i){
+    return i == 0 ? &tree->root : child_link(path[i - 1], path[i]);
+}
+
+/**
+ * 插入：先按路径查找，已存在时不做任何复制，否则复制路径并在复制出的节点上做插入调整
+ * 最多复制路径上的 d 个节点、新建 1 个节点、复制 d / 2 个叔叔节点，开始修改前一次预留
+ * @return 1 插入成功，0 已存在，-1 内存不足（树不变）
+ */
+int pinsert(PRbTree* tree, int value){
+    const PNode* hit;
+    if(!tree) return 0;
+    size_t d = search_depth(tree->root, value, &hit);
+    if(hit) return 0;
+    if(reserve_nodes(tree, 2 * d + 2) != 0) return -1;
+
+    PNode* path[PATH_MAX_DEPTH];
+    int found;
+    int k = copy_path(tree, path, value, &found) - 1;
+
+    PNode* x = pnode_new(tree, value);
+    if(k < 0){
+        tree->root = x;
+    } else if(value < path[k]->value){
+        path[k]->left = x;
+    } else {
+        path[k]->right = x;
+    }
+
+    // 与 insert_adjust 相同的几种情况，父节点、祖父节点都是复制出来的，叔叔节点改色前需要先复制
+    while(k >= 1 && IS_RED(path[k])){
+        PNode* p = path[k];
+        PNode* g = path[k - 1];
+        int pdir = g->left == p ? 0 : 1;
+        PNode** ulink = pdir == 0 ? &g->right : &g->left;
+        if(IS_RED(*ulink)){
+            PNode* u = own(tree, ulink);
+            u->color = BLACK;
+            p->color = BLACK;
+            g->color = RED;
+            x = g;
+            k -= 2;
+            continue;
+        }
+
+        int xdir = p->left == x ? 0 : 1;
+        if(xdir != pdir){
+            // x 是内侧孩子，先旋转 p，让 x、p 位于同一侧
+            rotate(tree, child_link(g, p), pdir);
+            p = x;
+        }
+        p->color = BLACK;
+        g->color = RED;
+        rotate(tree, path_link(tree, path, k - 1), !pdir);
+        break;
+    }
+    tree->root->color = BLACK;
+
+    tree->size++;
+    return 1;
+}
+
+/**
+ * 删除：复制根到被删除节点（两个孩子时一直到其后继）的路径，
+ * 然后按照 delete_adjust 的几种情况在复制出的节点上调整，兄弟节点及其孩子在改色、旋转前先复制。
+ * 路径长 d 时调整最多 d + 1 轮，每轮最多复制 4 个节点（兄弟、case 1 之后的新兄弟、近侧和远侧孩子），
+ * 加上最后的 x 和根，开始修改前一次预留
+ * @return 删除的节点数量，-1 内存不足（树不变）
+ */
+int pdelete(PRbTree* tree, int value){
+    const PNode* hit;
+    if(!tree) return 0;
+    size_t d = search_depth(tree->root, value, &hit);
+    if(!hit) return 0;
+    if(hit->left && hit->right)
+        for(hit = hit->right, ++d; hit->left; hit = hit->left) ++d;
+    if(reserve_nodes(tree, 5 * d + 6) != 0) return -1;
+
+    PNode* path[PATH_MAX_DEPTH];
+    int found;
+    int k = copy_path(tree, path, value, &found) - 1;
+    PNode* del = path[k];
+
+    if(del->left && del->right){
+        // 继续复制到右子树的最小节点，把它的值搬到 del 上，转化为删除最多只有一个孩子的节点
+        PNode** link = &del->right;
+        while(1){
+            PNode* n = own(tree, link);
+            path[++k] = n;
+            if(!n->left) break;
+            link = &n->left;
+        }
+        del->value = path[k]->value;
+        del = path[k];
+    }
+
+    // del 最多只有一个孩子，child 接替它的位置，child 的引用从 del 转移到父节点
+    PNode* child = del->left ? del->left : del->right;
+    Color delColor = del->color;
+    *path_link(tree, path, k) = child;
+    del->left = del->right = NULL;
+    decref(del);
+    --k;
+
+    if(delColor == BLACK){
+        // x 为当前“多一重黑色”的节点，由 path[k] 的 xdir 方向指向
+        PNode* x = child;
+        while(k >= 0 && !IS_RED(x)){
+            PNode* parent = path[k];
+            int xdir = parent->left == x ? 0 : 1;
+            PNode** wlink = xdir == 0 ? &parent->right : &parent->left;
+            PNode* w = own(tree, wlink);
+
+            if(w->color == RED){
+                // case 1：兄弟为红，旋转后 w 成为 parent 的父节点，路径上插入一层
+                w->color = BLACK;
+                parent->color = RED;
+                rotate(tree, path_link(tree, path, k), xdir);
+                path[k + 1] = parent;
+                path[k] = w;
+                ++k;
+                wlink = xdir == 0 ? &parent->right : &parent->left;
+                w = own(tree, wlink);
+            }
+
+            PNode** nearLink = xdir == 0 ? &w->left : &w->right;
+            PNode** farLink = xdir == 0 ? &w->right : &w->left;
+            if(!IS_RED(*nearLink) && !IS_RED(*farLink)){
+                // case 2：兄弟的两个孩子都是黑色
+                w->color = RED;
+                x = parent;
+                --k;
+                continue;
+            }
+
+            if(!IS_RED(*farLink)){
+                // case 3：近侧孩子为红，远侧孩子为黑，旋转兄弟节点
+                PNode* nearNode = own(tree, nearLink);
+                nearNode->color = BLACK;
+                w->color = RED;
+                rotate(tree, wlink, !xdir);
+                w = *wlink;
+                farLink = xdir == 0 ? &w->right : &w->left;
+            }
+
+            // case 4：远侧孩子为红
+            PNode* far = own(tree, farLink);
+            w->color = parent->color;
+            parent->color = BLACK;
+            far->color = BLACK;
+            rotate(tree, path_link(tree, path, k), xdir);
+            x = tree->root;
+            k = -1;
+            break;
+        }
+
+        if(IS_RED(x)){
+            // x 可能是原来共享的 child，改色前先复制
+            PNode** xlink = k >= 0 ? (path[k]->left == x ? &path[k]->left : &path[k]->right) : &tree->root;
+            x = own(tree, xlink);
+            x->color = BLACK;
+        }
+    }
+
+    if(tree->root && tree->root->color == RED){
+        own(tree, &tree->root)->color = BLACK;
+    }
+
+    tree->size--;
+    return 1;
+}
+
+/**
+ * 拿到当前版本的快照，之后的写操作不能再原地修改已有的节点：
+ * 版本号加一，已有节点的版本号都小于它，会被 own 复制；上一次快照之后新建的节点没有被任何快照引用，一直可以原地修改
+ */
+PSnapshot psnapshot(PRbTree* tree){
+    PSnapshot snap;
+    tree->version++;
+    if(tree->version == 0) tree->version = 1;
+    incref(tree->root);
+    snap.root = tree->root;
+    snap.size = tree->size;
+    return snap;
+}
+
+void prelease_snapshot(PSnapshot* snap){
+    decref((PNode*) snap->root);
+    snap->root = NULL;
+    snap->size = 0;
+}
+
+static void piter_push_left(PIter* it, const PNode* n){
+    while(n){
+        it->stack[it->top++] = n;
+        n = n->left;
+    }
+}
+
+void piter_begin(PIter* it, const PNode* root){
+    it->top = 0;
+    piter_push_left(it, root);
+}
+
+const PNode* piter_next(PIter* it){
+    if(it->top == 0) return NULL;
+    const PNode* n = it->stack[--it->top];
+    piter_push_left(it, n->right);
+    return n;
+}
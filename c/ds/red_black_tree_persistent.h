@@ -0,0 +1,71 @@
+/*
+ * 可持久化（path copying）红黑树
+ *
+ * 插入、删除时不修改已有节点，而是复制根到修改位置路径上的 O(log n) 个节点，
+ * 旋转和改色也只作用在复制出来的节点上，没有被修改的子树在新旧版本之间共享。
+ * 因此任何时刻拿到的根节点都是一个不可变的版本，psnapshot 只需要增加根节点的引用计数，O(1)。
+ *
+ * 节点通过引用计数回收：引用计数为指向它的父节点/根的个数，最后一个引用它的版本被释放时节点被回收。
+ * 节点没有 parent 指针（共享的子树可以属于多个父节点），遍历使用显式栈。
+ *
+ * 并发约定：写操作（pinsert/pdelete/psnapshot/destroy_ptree）需要在同一个线程或者同一把锁下调用，
+ * 拿到的快照可以交给任意线程读取、遍历和释放（prelease_snapshot），读写互不阻塞。
+ */
+#ifndef RED_BLACK_TREE_PERSISTENT_H
+#define RED_BLACK_TREE_PERSISTENT_H
+
+#include <stddef.h>
+#include "red_black_tree.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct PNode{
+    struct PNode* left;
+    struct PNode* right;
+    int value;
+    Color color;
+    int refs;              // 引用计数，原子操作
+    unsigned version;      // 创建该节点时树的版本号，等于树的当前版本时说明还没有被快照共享，可以原地修改
+} PNode;
+
+typedef struct PRbTree{
+    PNode* root;
+    size_t size;
+    unsigned version;      // 每次 psnapshot 加一
+    PNode* spare;          // 预留的节点，写操作中途不会因为内存不足失败
+    size_t spare_count;
+    unsigned long rotations; // 累计的旋转次数
+} PRbTree;
+
+// 不可变的快照
+typedef struct PSnapshot{
+    const PNode* root;
+    size_t size;
+} PSnapshot;
+
+// 快照的中序遍历迭代器，显式栈，int key 的红黑树高度不会超过 64
+typedef struct PIter{
+    const PNode* stack[64];
+    int top;
+} PIter;
+
+PRbTree* new_ptree();
+void destroy_ptree(PRbTree* tree);
+
+int pinsert(PRbTree* tree, int value);
+int pdelete(PRbTree* tree, int value);
+const PNode* psearch(const PNode* root, int value);
+
+PSnapshot psnapshot(PRbTree* tree);
+void prelease_snapshot(PSnapshot* snap);
+
+void piter_begin(PIter* it, const PNode* root);
+const PNode* piter_next(PIter* it);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,231 @@
+/*
+ * 按 key 范围分片的并发红黑树，说明见 red_black_tree_sharded.h
+ */
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "red_black_tree_sharded.h"
+
+static int shard_lo(const Shard* s){
+    return __atomic_load_n(&s->lo, __ATOMIC_ACQUIRE);
+}
+
+// 最后一个下界 <= value 的分片，不加锁，结果需要在加锁后用 owns 确认
+static int route(const ShardedTree* t, int value){
+    int l = 0, r = t->count - 1;
+    while(l < r){
+        int m = (l + r + 1) / 2;
+        if(shard_lo(&t->shards[m]) <= value) l = m;
+        else r = m - 1;
+    }
+    return l;
+}
+
+// value 是否属于分片 i，调用方需要持有分片 i 的锁，此时 i 的上下界都不会变化
+static int owns(const ShardedTree* t, int i, int value){
+    if(i > 0 && value < shard_lo(&t->shards[i])) return 0;
+    if(i + 1 < t->count && value >= shard_lo(&t->shards[i + 1])) return 0;
+    return 1;
+}
+
+// 锁住 value 所在的分片并返回其下标
+static int lock_shard(ShardedTree* t, int value, int write){
+    while(1){
+        int i = route(t, value);
+        Shard* s = &t->shards[i];
+        if(write) pthread_rwlock_wrlock(&s->lock);
+        else pthread_rwlock_rdlock(&s->lock);
+        if(owns(t, i, value)) return i;
+        pthread_rwlock_unlock(&s->lock);
+    }
+}
+
+/**
+ * 创建 shards 个分片，初始边界把 [lo, hi] 等分，范围之外的 key 落在第一个或最后一个分片中
+ * @return 内存不足时返回 NULL
+ */
+ShardedTree* new_sharded_tree(int shards, int lo, int hi){
+    int i;
+    if(shards < 1) shards = 1;
+    if(hi < lo) hi = lo;
+    ShardedTree* t = (ShardedTree*) malloc(sizeof(ShardedTree));
+    if(!t) return NULL;
+    t->shards = (Shard*) aligned_alloc(64, shards * sizeof(Shard));
+    if(!t->shards){
+        perror("create sharded tree error.");
+        free(t);
+        return NULL;
+    }
+    t->count = 0;
+    t->rebalances = 0;
+    pthread_mutex_init(&t->rebalance_lock, NULL);
+    for(i = 0; i < shards; ++i){
+        Shard* s = &t->shards[i];
+        NodeAllocator* a = new_slab_allocator(4096);
+        s->tree = a ? new_tree_with_allocator(a) : NULL;
+        if(!s->tree){
+            // 拆掉已经建好的分片，destroy_sharded_tree 只处理前 count 个
+            if(a) a->destroy(a);
+            destroy_sharded_tree(t);
+            return NULL;
+        }
+        pthread_rwlock_init(&s->lock, NULL);
+        s->lo = i == 0 ? INT_MIN : (int)(lo + ((long long) hi - lo + 1) * i / shards);
+        s->writes = 0;
+        t->count++;
+    }
+    return t;
+}
+
+void destroy_sharded_tree(ShardedTree* t){
+    int i;
+    if(!t) return;
+    for(i = 0; i < t->count; ++i){
+        destroy_tree(t->shards[i].tree);
+        pthread_rwlock_destroy(&t->shards[i].lock);
+    }
+    pthread_mutex_destroy(&t->rebalance_lock);
+    free(t->shards);
+    free(t);
+}
+
+/**
+ * 把分片 from 中靠近分片 to 一侧的 m 个 key 挪过去，并移动两者之间的边界
+ * 调用方持有两个分片的写锁。先插入 to 再从 from 删除，内存不足时提前停止，不会丢失 key
+ */
+static void move_keys(ShardedTree* t, int from, int to, size_t m){
+    RbTree* a = t->shards[from].tree;
+    RbTree* b = t->shards[to].tree;
+    size_t k;
+    int moved = 0, last = 0;
+    for(k = 0; k < m; ++k){
+        TNode* n = to > from ? tree_max(a) : tree_min(a);
+        if(insert(b, n->value) != 1) break;
+        last = n->value;
+        moved = 1;
+        erase_node(a, n);
+    }
+    if(!moved) return;
+
+    // 向右挪的是 from 中最大的 key，最后一个挪走的就是 to 的新下界；向左挪时 from 的新下界是剩下的最小 key
+    if(to > from) __atomic_store_n(&t->shards[to].lo, last, __ATOMIC_RELEASE);
+    else __atomic_store_n(&t->shards[from].lo, tree_min(a)->value, __ATOMIC_RELEASE);
+    t->rebalances++;
+}
+
+/**
+ * 分片 i 的写次数达到 SHARD_CHECK_INTERVAL 后调用，按下标顺序锁住 i 和它的左右邻居，
+ * 与较小的邻居比较：节点数超过对方两倍时挪走差值的一半，写次数超过对方两倍时挪走四分之一，
+ * 每次最多挪 SHARD_MAX_MOVE 个，不平衡没有消除时下一次检查会接着挪
+ */
+static void rebalance(ShardedTree* t, int i){
+    int first = i > 0 ? i - 1 : i;
+    int last = i + 1 < t->count ? i + 1 : i;
+    int k, j = -1;
+    if(pthread_mutex_trylock(&t->rebalance_lock) != 0) return;
+
+    for(k = first; k <= last; ++k) pthread_rwlock_wrlock(&t->shards[k].lock);
+    for(k = first; k <= last; ++k){
+        if(k != i && (j < 0 || t->shards[k].tree->size < t->shards[j].tree->size)) j = k;
+    }
+
+    Shard* a = &t->shards[i];
+    size_t move = 0;
+    if(j >= 0){
+        Shard* b = &t->shards[j];
+        if(a->tree->size > 2 * b->tree->size + SHARD_MIN_MOVE){
+            move = (a->tree->size - b->tree->size) / 2;
+        } else if(a->writes > 2 * b->writes + SHARD_CHECK_INTERVAL && a->tree->size >= 4 * SHARD_MIN_MOVE){
+            move = a->tree->size / 4;
+        }
+        if(move > SHARD_MAX_MOVE) move = SHARD_MAX_MOVE;
+        if(move) move_keys(t, i, j, move);
+        b->writes = 0;
+    }
+    // 挪满上限说明可能还没平衡，再过 SHARD_MAX_MOVE 次写就检查一次，平均每次写最多分摊一个 key 的挪动
+    a->writes = move == SHARD_MAX_MOVE ? SHARD_CHECK_INTERVAL - SHARD_MAX_MOVE : 0;
+
+    for(k = last; k >= first; --k) pthread_rwlock_unlock(&t->shards[k].lock);
+    pthread_mutex_unlock(&t->rebalance_lock);
+}
+
+/**
+ * @return 与 insert 相同
+ */
+int sharded_insert(ShardedTree* t, int value){
+    int i = lock_shard(t, value, 1);
+    Shard* s = &t->shards[i];
+    int ret = insert(s->tree, value);
+    int check = ++s->writes >= SHARD_CHECK_INTERVAL;
+    pthread_rwlock_unlock(&s->lock);
+    if(check) rebalance(t, i);
+    return ret;
+}
+
+int sharded_delete(ShardedTree* t, int value){
+    int i = lock_shard(t, value, 1);
+    Shard* s = &t->shards[i];
+    int ret = delete_node(s->tree, value);
+    int check = ++s->writes >= SHARD_CHECK_INTERVAL;
+    pthread_rwlock_unlock(&s->lock);
+    if(check) rebalance(t, i);
+    return ret;
+}
+
+int sharded_contains(ShardedTree* t, int value){
+    int i = lock_shard(t, value, 0);
+    int ret = search_node(t->shards[i].tree, value) != NULL;
+    pthread_rwlock_unlock(&t->shards[i].lock);
+    return ret;
+}
+
+// 各分片节点数之和，分片之间不是同一时刻的值
+size_t sharded_size(ShardedTree* t){
+    size_t total = 0;
+    int i;
+    for(i = 0; i < t->count; ++i){
+        pthread_rwlock_rdlock(&t->shards[i].lock);
+        total += t->shards[i].tree->size;
+        pthread_rwlock_unlock(&t->shards[i].lock);
+    }
+    return total;
+}
+
+typedef struct StitchCtx{
+    ScanCallback callback;
+    void* ctx;
+    int stopped;
+} StitchCtx;
+
+static int stitch_callback(const int* keys, size_t n, void* ctx){
+    StitchCtx* sc = (StitchCtx*) ctx;
+    if(sc->callback(keys, n, sc->ctx)){
+        sc->stopped = 1;
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * 按升序扫描 [lo, hi]，语义与 range_scan 相同
+ * 每个分片在读锁下扫描，callback 在持有读锁时被调用，不能在 callback 中修改这棵树
+ */
+size_t sharded_range_scan(ShardedTree* t, int lo, int hi, int* buf, size_t batch, ScanCallback callback, void* ctx){
+    size_t total = 0;
+    long next = lo;
+    StitchCtx sc;
+    if(!buf || !batch || lo > hi) return 0;
+    sc.callback = callback;
+    sc.ctx = ctx;
+    sc.stopped = 0;
+
+    while(next <= hi && !sc.stopped){
+        int i = lock_shard(t, (int) next, 0);
+        long upper = i + 1 < t->count ? (long) shard_lo(&t->shards[i + 1]) : (long) INT_MAX + 1;
+        int end = upper - 1 < hi ? (int)(upper - 1) : hi;
+        total += range_scan(t->shards[i].tree, (int) next, end, buf, batch, stitch_callback, &sc);
+        pthread_rwlock_unlock(&t->shards[i].lock);
+        next = upper;
+    }
+    return total;
+}
@@ -0,0 +1,61 @@
+/*
+ * 按 key 范围分片的并发红黑树
+ *
+ * RbTree 本身没有任何同步，多个写线程只能在外面共用一把锁。这里把 key 空间划分成若干个连续的区间，
+ * 每个区间是一棵独立的 RbTree（各自的 slab 分配器），配一把读写锁，不同分片上的读写互不影响。
+ *
+ * 分片 i 负责 [lo_i, lo_{i+1})，第一个分片向下、最后一个分片向上包含所有 key。
+ * 路由时不加锁读取边界（二分查找），拿到分片的锁之后再检查一次 key 是否还在这个分片的范围内，
+ * 不在（边界刚好被移动了）就放锁重试。边界只会在同时持有相邻两个分片写锁时修改，所以持有分片锁时的检查是可靠的。
+ *
+ * 每个分片每完成 SHARD_CHECK_INTERVAL 次写操作检查一次是否需要重新平衡：
+ * 与相邻分片中较小的一个比较，节点数超过对方的两倍（过大），或者这段时间的写次数超过对方的两倍（过热），
+ * 就把靠近边界的一部分 key 挪到相邻分片并移动边界。同一时刻只有一个线程做重新平衡（trylock），写线程不会等待它。
+ * 挪动期间三个分片的写锁都被持有，所以一次最多挪 SHARD_MAX_MOVE 个 key，没挪完的部分留给之后的检查继续。
+ *
+ * 范围扫描按分片依次进行：每次把当前位置路由到所在分片，在读锁下扫描到这个分片的上界，再从上界继续，
+ * 扫描过程中边界移动也不会遗漏或重复 key（扫描期间一直存在的 key 恰好返回一次），但不是一个一致的快照。
+ */
+#ifndef RED_BLACK_TREE_SHARDED_H
+#define RED_BLACK_TREE_SHARDED_H
+
+#include <pthread.h>
+#include <stddef.h>
+#include "red_black_tree.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SHARD_CHECK_INTERVAL 4096
+#define SHARD_MIN_MOVE 64
+#define SHARD_MAX_MOVE 1024
+
+typedef struct Shard{
+    pthread_rwlock_t lock;
+    RbTree* tree;
+    int lo;                    // 分片的下界，原子读写
+    unsigned long writes;      // 上一次检查以来的写次数，持有写锁时修改
+} __attribute__((aligned(64))) Shard;
+
+typedef struct ShardedTree{
+    Shard* shards;
+    int count;
+    pthread_mutex_t rebalance_lock;
+    unsigned long rebalances;  // 已经完成的边界移动次数
+} ShardedTree;
+
+ShardedTree* new_sharded_tree(int shards, int lo, int hi);
+void destroy_sharded_tree(ShardedTree* tree);
+
+int sharded_insert(ShardedTree* tree, int value);
+int sharded_delete(ShardedTree* tree, int value);
+int sharded_contains(ShardedTree* tree, int value);
+size_t sharded_size(ShardedTree* tree);
+size_t sharded_range_scan(ShardedTree* tree, int lo, int hi, int* buf, size_t batch, ScanCallback callback, void* ctx);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
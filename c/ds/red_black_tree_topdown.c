@@ -0,0 +1,256 @@
+/*
+ * 自顶向下的红黑树，说明见 red_black_tree_topdown.h
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include "red_black_tree_topdown.h"
+
+#define TD_CHUNK_NODES 4096
+
+#define IS_RED(n) ((n) && (n)->color == RED)
+
+static TDNode* td_alloc(TDTree* t, int value){
+    TDNode* n = t->free_list;
+    if(n){
+        t->free_list = n->link[0];
+    } else {
+        if(!t->chunks || t->chunk_used == TD_CHUNK_NODES){
+            TDChunk* c = (TDChunk*) malloc(sizeof(TDChunk) + TD_CHUNK_NODES * sizeof(TDNode));
+            if(!c){
+                perror("create node error.");
+                return NULL;
+            }
+            c->next = t->chunks;
+            t->chunks = c;
+            t->chunk_used = 0;
+        }
+        n = &t->chunks->nodes[t->chunk_used++];
+    }
+    n->link[0] = n->link[1] = NULL;
+    n->value = value;
+    n->color = RED;
+    return n;
+}
+
+static void td_free(TDTree* t, TDNode* n){
+    n->link[0] = t->free_list;
+    t->free_list = n;
+}
+
+TDTree* new_td_tree(){
+    TDTree* t = (TDTree*) malloc(sizeof(TDTree));
+    if(!t){
+        perror("create tree error.");
+        return NULL;
+    }
+    t->root = NULL;
+    t->chunks = NULL;
+    t->chunk_used = 0;
+    t->free_list = NULL;
+    t->size = 0;
+    t->rotations = 0;
+    return t;
+}
+
+void destroy_td_tree(TDTree* t){
+    if(!t) return;
+    TDChunk* c = t->chunks;
+    while(c){
+        TDChunk* next = c->next;
+        free(c);
+        c = next;
+    }
+    free(t);
+}
+
+/**
+ * 单旋转：root 的 !dir 侧孩子上升，dir 为 0 时相当于右旋，为 1 时相当于左旋
+ * 旋转后原来的 root 变红，上升的节点变黑
+ */
+static TDNode* rotate_single(TDTree* tree, TDNode* root, int dir){
+    TDNode* save = root->link[!dir];
+    tree->rotations++;
+    root->link[!dir] = save->link[dir];
+    save->link[dir] = root;
+    root->color = RED;
+    save->color = BLACK;
+    return save;
+}
+
+// 双旋转：先旋转 !dir 侧的孩子，再旋转 root
+static TDNode* rotate_double(TDTree* tree, TDNode* root, int dir){
+    root->link[!dir] = rotate_single(tree, root->link[!dir], !dir);
+    return rotate_single(tree, root, dir);
+}
+
+// 用比较结果直接作为 link 的下标，没有分支，随机查找时不会有分支预测失败
+const TDNode* td_search(const TDTree* t, int value){
+    const TDNode* n = t->root;
+    while(n && n->value != value)
+        n = n->link[n->value < value];
+    return n;
+}
+
+/**
+ * 插入，一遍向下完成
+ * 向下经过的节点 q 两个孩子都为红时，q 变红、孩子变黑（黑高不变），
+ * 这可能和 q 的父节点 p 形成连续的红色，此时 g、p、q 都在手边，用一次单旋转或双旋转修复，
+ * 由于上方已经做过同样的处理，p 的兄弟一定是黑色，修复后不会再向上传播
+ * @return 1 插入成功，0 已存在，-1 内存不足（之前做过的改色、旋转依然保持红黑树的性质）
+ */
+int td_insert(TDTree* tree, int value){
+    int ret = 0;
+    if(!tree) return 0;
+    if(!tree->root){
+        tree->root = td_alloc(tree, value);
+        if(!tree->root) return -1;
+        tree->root->color = BLACK;
+        tree->size++;
+        return 1;
+    }
+
+    TDNode head = { { NULL, NULL }, 0, BLACK };   // 假的根，root 为它的右孩子
+    TDNode *t = &head, *g = NULL, *p = NULL, *q;   // t 为曾祖父，g 为祖父，p 为父节点
+    int dir = 0, last = 0;
+    q = t->link[1] = tree->root;
+
+    while(1){
+        if(!q){
+            q = td_alloc(tree, value);
+            if(!q){
+                ret = -1;
+                break;
+            }
+            p->link[dir] = q;
+            ret = 1;
+        } else if(IS_RED(q->link[0]) && IS_RED(q->link[1])){
+            // 改色
+            q->color = RED;
+            q->link[0]->color = BLACK;
+            q->link[1]->color = BLACK;
+        }
+
+        // 修复连续的红色
+        if(IS_RED(q) && IS_RED(p)){
+            int dir2 = t->link[1] == g;
+            if(q == p->link[last])
+                t->link[dir2] = rotate_single(tree, g, !last);
+            else
+                t->link[dir2] = rotate_double(tree, g, !last);
+        }
+
+        if(q->value == value) break;
+        last = dir;
+        dir = q->value < value;
+        if(g) t = g;
+        g = p;
+        p = q;
+        q = q->link[dir];
+    }
+
+    tree->root = head.link[1];
+    tree->root->color = BLACK;
+    if(ret == 1) tree->size++;
+    return ret;
+}
+
+/**
+ * 删除，一遍向下完成
+ * 向下时保证当前节点 q 或者它下一步要去的孩子是红色的：
+ * q 与 q->link[dir] 都是黑色时，如果另一个孩子为红，旋转让它上升；否则看 q 的兄弟 s，
+ * s 的两个孩子都为黑时做反向的改色（p 变黑，q、s 变红），否则从 s 借一个红色节点过来（单旋转或双旋转）。
+ * 找到目标后继续走到它的前驱（左子树的最大节点，没有左子树时就是它自己），前驱一定是红色或者为根，
+ * 把前驱的值搬到目标节点上，直接摘除前驱
+ * @return 删除的节点数量（不存在时树也可能被改色、旋转过，但依然满足红黑树的性质）
+ */
+int td_delete(TDTree* tree, int value){
+    if(!tree || !tree->root) return 0;
+
+    TDNode head = { { NULL, NULL }, 0, BLACK };
+    TDNode *q = &head, *p = NULL, *g = NULL;
+    TDNode* f = NULL;   // 找到的目标节点
+    int dir = 1;
+    q->link[1] = tree->root;
+
+    while(q->link[dir]){
+        int last = dir;
+        g = p;
+        p = q;
+        q = q->link[dir];
+        dir = q->value < value;
+        if(q->value == value) f = q;
+
+        // 把红色推下来
+        if(!IS_RED(q) && !IS_RED(q->link[dir])){
+            if(IS_RED(q->link[!dir])){
+                p = p->link[last] = rotate_single(tree, q, dir);
+            } else {
+                TDNode* s = p->link[!last];
+                if(s){
+                    if(!IS_RED(s->link[!last]) && !IS_RED(s->link[last])){
+                        // 改色
+                        p->color = BLACK;
+                        s->color = RED;
+                        q->color = RED;
+                    } else {
+                        int dir2 = g->link[1] == p;
+                        if(IS_RED(s->link[last]))
+                            g->link[dir2] = rotate_double(tree, p, last);
+                        else
+                            g->link[dir2] = rotate_single(tree, p, last);
+                        // 修正颜色
+                        q->color = RED;
+                        g->link[dir2]->color = RED;
+                        g->link[dir2]->link[0]->color = BLACK;
+                        g->link[dir2]->link[1]->color = BLACK;
+                    }
+                }
+            }
+        }
+    }
+
+    if(f){
+        f->value = q->value;
+        p->link[p->link[1] == q] = q->link[q->link[0] == NULL];
+        td_free(tree, q);
+        tree->size--;
+    }
+
+    tree->root = head.link[1];
+    if(tree->root) tree->root->color = BLACK;
+    return f != NULL;
+}
+
+// ------------------------- 有序遍历 -------------------------
+static void td_push_left(TDIter* it, const TDNode* n){
+    while(n){
+        it->stack[it->top++] = n;
+        n = n->link[0];
+    }
+}
+
+void td_iter_begin(TDIter* it, const TDTree* tree){
+    it->top = 0;
+    td_push_left(it, tree->root);
+}
+
+// 定位到第一个 >= value 的节点，之后的 td_iter_next 从它开始返回
+void td_iter_seek(TDIter* it, const TDTree* tree, int value){
+    const TDNode* n = tree->root;
+    it->top = 0;
+    while(n){
+        if(value <= n->value){
+            it->stack[it->top++] = n;
+            n = n->link[0];
+        } else {
+            n = n->link[1];
+        }
+    }
+}
+
+const TDNode* td_iter_next(TDIter* it){
+    if(it->top == 0) return NULL;
+    const TDNode* n = it->stack[--it->top];
+    td_push_left(it, n->link[1]);
+    return n;
+}
@@ -0,0 +1,65 @@
+/*
+ * 自顶向下（top-down）的红黑树
+ *
+ * red_black_tree.c 的插入先从根向下找到位置，再由 insert_adjust 沿着 parent 指针向上调整，删除也一样，
+ * 一次修改要把路径走两遍，每个节点还要多 8 字节的 parent。
+ * 这里参考 Julienne Walker 的 top-down 红黑树：向下查找的同时就完成改色和旋转，
+ * 插入时遇到两个孩子都是红色的节点就提前改色，保证到达插入位置时父节点可以直接修复；
+ * 删除时一路把红色“推”到当前节点，保证到达被删除的节点时它是红色的，可以直接摘除。
+ * 整个修改只需要一遍，不需要 parent 指针，节点为 link[2] + value + color，共 24 字节。
+ *
+ * 删除两个孩子的节点时是把前驱的值搬过来，再摘除前驱节点，因此修改之后不能再持有节点指针。
+ * 没有 parent 指针，有序遍历使用显式栈的迭代器。
+ */
+#ifndef RED_BLACK_TREE_TOPDOWN_H
+#define RED_BLACK_TREE_TOPDOWN_H
+
+#include <stddef.h>
+#include "red_black_tree.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct TDNode{
+    struct TDNode* link[2];    // link[0] 左孩子，link[1] 右孩子
+    int value;
+    Color color;
+} TDNode;
+
+// 节点按块分配，回收的节点通过 link[0] 串成空闲链表
+typedef struct TDChunk{
+    struct TDChunk* next;
+    TDNode nodes[];
+} TDChunk;
+
+typedef struct TDTree{
+    TDNode* root;
+    TDChunk* chunks;
+    size_t chunk_used;
+    TDNode* free_list;
+    size_t size;
+    unsigned long rotations;  // 累计的旋转次数，双旋转算两次
+} TDTree;
+
+// 中序遍历迭代器，显式栈，int key 的红黑树高度不会超过 64
+typedef struct TDIter{
+    const TDNode* stack[64];
+    int top;
+} TDIter;
+
+TDTree* new_td_tree();
+void destroy_td_tree(TDTree* tree);
+int td_insert(TDTree* tree, int value);
+int td_delete(TDTree* tree, int value);
+const TDNode* td_search(const TDTree* tree, int value);
+
+void td_iter_begin(TDIter* it, const TDTree* tree);
+void td_iter_seek(TDIter* it, const TDTree* tree, int value);
+const TDNode* td_iter_next(TDIter* it);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif